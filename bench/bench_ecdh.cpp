@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "agent_core.h"
+#include "agent_test_util.h"
+#include "emulated_device.h"
+
+// Time per ecdh@ledger.com request against the emulator, with the shared
+// secret cache off and on, cycling through a number of peer keys.
+//
+//  bench_ecdh [requests] [peers] [approval delay ms]
+//
+// The approval delay stands for the user confirming on the device, every
+// request the cache answers is spared it.
+
+// uncompressed points of other keys on the emulator, as a peer would send them
+static bool MakePeerKeys(AgentCore& agent, size_t numPeers, std::vector<std::vector<uint8_t>>& outPeerKeys) {
+	for (size_t i = 0; i < numPeers; ++i) {
+		Identity peer("ssh://peer" + std::to_string(i) + "@bench");
+		peer.InitKeyType("nistp256");
+
+		// key type, curve, point
+		uint16_t status = 0;
+		const ByteArray keyBlob = agent.FetchPublicKey(peer, &status);
+		SshReader reader(keyBlob.Get().data(), keyBlob.Size());
+		ByteSpan keyType;
+		ByteSpan curve;
+		ByteSpan point;
+		if (!reader.ReadString(keyType) || !reader.ReadString(curve) || !reader.ReadString(point)) {
+			fprintf(stderr, "no peer key, status %04x\n", status);
+			return false;
+		}
+		outPeerKeys.push_back(std::vector<uint8_t>(point.data, point.data + point.size));
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	const size_t numRequests = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200;
+	const size_t numPeers = argc > 2 ? strtoul(argv[2], nullptr, 10) : 4;
+	if (numRequests == 0 || numPeers == 0) {
+		fprintf(stderr, "usage: bench_ecdh [requests] [peers] [approval delay ms]\n");
+		return 1;
+	}
+
+	EmulatorConfig config;
+	config.approvalDelayMs = argc > 3 ? atoi(argv[3]) : 0;
+	IdentityList identities;
+	DevicePool devices;
+	devices.Attach(std::unique_ptr<HidBackend>(new EmulatedDevice(config)));
+	AgentCore agent(devices, identities);
+
+	// the identity decrypting, ECDH runs on NIST P-256 on the emulator
+	Identity ident("ssh://user@host");
+	ident.InitKeyType("nistp256");
+	uint16_t status = 0;
+	const ByteArray keyBlob = agent.FetchPublicKey(ident, &status);
+	if (keyBlob.Empty()) {
+		fprintf(stderr, "emulator not ready, status %04x\n", status);
+		return 1;
+	}
+	identities.Add("ssh://user@host", keyBlob.Get());
+	identities.mIdentities[0].keyType = ident.keyType;
+
+	std::vector<std::vector<uint8_t>> peerKeys;
+	if (!MakePeerKeys(agent, numPeers, peerKeys)) {
+		return 1;
+	}
+
+	std::vector<std::vector<uint8_t>> requests;
+	for (const std::vector<uint8_t>& peerKey : peerKeys) {
+		requests.push_back(MakeRequest(SSH2_AGENTC_EXTENSION, [&](SshWriter& writer) {
+			writer.WriteString("ecdh@ledger.com");
+			writer.WriteString(keyBlob.Get().data(), keyBlob.Size());
+			writer.WriteString(peerKey.data(), peerKey.size());
+		}));
+	}
+
+	printf("%8s %8s %8s %8s %12s\n", "cache", "requests", "peers", "hits", "us/request");
+	const size_t cacheSizes[] = { 0, 256 };
+	for (size_t cacheSize : cacheSizes) {
+		agent.GetEcdhCache().SetLimits(cacheSize, std::chrono::seconds(600));
+		const uint64_t hitsBefore = agent.GetEcdhCache().GetStats().hits;
+
+		AgentClient client;
+		SharedResponse response;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < numRequests; ++i) {
+			const std::vector<uint8_t>& request = requests[i % requests.size()];
+			agent.HandleRequest(client, request.data(), request.size(), response);
+			if (ResponseType(response) != SSH_AGENT_SUCCESS) {
+				fprintf(stderr, "ECDH request %u failed\n", (unsigned)i);
+				return 1;
+			}
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+		const uint64_t hits = agent.GetEcdhCache().GetStats().hits - hitsBefore;
+		printf("%8u %8u %8u %8u %12.0f\n", (unsigned)cacheSize, (unsigned)numRequests, (unsigned)numPeers,
+			(unsigned)hits, elapsed.count() / numRequests);
+	}
+
+	return 0;
+}
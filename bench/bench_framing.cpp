@@ -0,0 +1,100 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "hid_framing.h"
+#include "hid_transport.h"
+#include "loopback_backend.h"
+
+// HID framing cost per APDU size: framing a command into reports, rebuilding
+// a response from reports, and whole exchanges through HidTransport against
+// a loopback device, with the heap allocations each one makes.
+//
+//  bench_framing [iterations]
+
+typedef std::chrono::duration<double, std::nano> Nanoseconds;
+
+static std::vector<uint8_t> MakePayload(size_t size) {
+	std::vector<uint8_t> payload(size);
+	for (size_t i = 0; i < size; ++i) {
+		payload[i] = (uint8_t)i;
+	}
+	return payload;
+}
+
+static void PrintRow(const char* what, size_t bytes, size_t reports, size_t iterations, Nanoseconds elapsed, size_t allocations) {
+	const double perIteration = elapsed.count() / iterations;
+	printf("%-12s %8u %8u %12.0f %10.1f %12.2f\n", what, (unsigned)bytes, (unsigned)reports, perIteration,
+		bytes / perIteration * 1000.0, (double)allocations / iterations);
+}
+
+int main(int argc, char** argv) {
+	const size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000;
+	const size_t payloadSizes[] = { 5, 64, 255, 1024, 4096, 16384 };
+
+	printf("%-12s %8s %8s %12s %10s %12s\n", "", "bytes", "reports", "ns/op", "MB/s", "allocs/op");
+	for (size_t payloadSize : payloadSizes) {
+		std::vector<uint8_t> payload = MakePayload(payloadSize);
+		APDU apdu(0x80, 0x04, 0x00, 0x00, payload.data(), payload.size());
+		const size_t bytes = apdu.SerializedSize();
+
+		// command into reports
+		ApduFramer framer;
+		size_t reports = 0;
+		size_t checksum = 0;
+		size_t allocations = AllocationCount();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i) {
+			reports = 0;
+			framer.Begin(apdu);
+			while (framer.Next()) {
+				checksum += framer.Report()[packet_size];
+				reports++;
+			}
+		}
+		PrintRow("frame", bytes, reports, iterations, std::chrono::steady_clock::now() - start, AllocationCount() - allocations);
+
+		// the same reports back into a message
+		std::vector<uint8_t> frames;
+		framer.Begin(apdu);
+		while (framer.Next()) {
+			frames.insert(frames.end(), framer.Report() + 1, framer.Report() + 1 + packet_size);
+		}
+
+		ApduReassembler reassembler;
+		allocations = AllocationCount();
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i) {
+			reassembler.Reset();
+			for (size_t offset = 0; offset < frames.size(); offset += packet_size) {
+				reassembler.Feed(frames.data() + offset, packet_size);
+			}
+			checksum += reassembler.MessageSize();
+		}
+		PrintRow("reassemble", bytes, reports, iterations, std::chrono::steady_clock::now() - start, AllocationCount() - allocations);
+
+		// command out and its echo back, as a device exchange
+		HidTransport transport{ std::unique_ptr<HidBackend>(new LoopbackBackend(extendedPayloadMax)) };
+		transport.Open();
+		ApduResponse response;
+		allocations = AllocationCount();
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; ++i) {
+			if (!transport.Exchange(apdu, response)) {
+				fprintf(stderr, "exchange of %u bytes failed\n", (unsigned)bytes);
+				return 1;
+			}
+		}
+		PrintRow("exchange", 2 * bytes, 2 * reports, iterations, std::chrono::steady_clock::now() - start, AllocationCount() - allocations);
+
+		// keeps the loops from being optimized away
+		if (checksum == 1) {
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
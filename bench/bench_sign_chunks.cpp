@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "device_pool.h"
+#include "device_signer.h"
+#include "emulated_device.h"
+#include "identity.h"
+
+// Round trips and wall time per sign against the emulator, across challenge
+// sizes, with short APDUs (the stock app) and with extended ones.
+//
+//  bench_sign_chunks [signs per size] [report interval us]
+//
+// Each report written and read waits for the interval, 1 ms by default as
+// a full speed HID device is polled, so the time follows the round trips.
+
+// counts the commands and reports written to the emulator, and paces them
+class CountingBackend : public HidBackend {
+public:
+	CountingBackend(std::unique_ptr<HidBackend> backend, std::chrono::microseconds reportInterval)
+		: mBackend(std::move(backend))
+		, mReportInterval(reportInterval) {
+	}
+
+	bool Open() override {
+		return mBackend->Open();
+	}
+
+	void Close() override {
+		mBackend->Close();
+	}
+
+	bool IsOpen() const override {
+		return mBackend->IsOpen();
+	}
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override {
+		std::this_thread::sleep_for(mReportInterval);
+		return mBackend->Read(data, length, timeoutMs);
+	}
+
+	int Write(const uint8_t* data, size_t length) override {
+		// report id, channel(2), tag, sequence(2): sequence 0 starts a command
+		if (length > 5 && data[4] == 0 && data[5] == 0) {
+			commands++;
+		}
+		reports++;
+		std::this_thread::sleep_for(mReportInterval);
+		return mBackend->Write(data, length);
+	}
+
+	size_t GetMaxPayload() const override {
+		return mBackend->GetMaxPayload();
+	}
+
+	size_t commands = 0;
+	size_t reports = 0;
+
+private:
+	std::unique_ptr<HidBackend> mBackend;
+	std::chrono::microseconds mReportInterval;
+};
+
+int main(int argc, char** argv) {
+	const size_t signs = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20;
+	const std::chrono::microseconds reportInterval(argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000);
+	const size_t challengeSizes[] = { 64, 256, 1024, 4096, 16384 };
+	const size_t payloads[] = { shortPayloadMax, extendedPayloadMax };
+
+	Identity ident("ssh://user@host");
+	ident.InitKeyType("nistp256");
+
+	printf("%8s %8s %12s %12s %12s\n", "bytes", "payload", "APDUs/sign", "reports/sign", "us/sign");
+	for (size_t payload : payloads) {
+		EmulatorConfig config;
+		config.maxPayload = payload;
+
+		CountingBackend* counter = new CountingBackend(std::unique_ptr<HidBackend>(new EmulatedDevice(config)), reportInterval);
+		DevicePool pool;
+		pool.Attach(std::unique_ptr<HidBackend>(counter));
+		if (!pool.Open()) {
+			fprintf(stderr, "emulator not ready\n");
+			return 1;
+		}
+
+		DeviceSigner signer(pool);
+		for (size_t challengeSize : challengeSizes) {
+			std::vector<uint8_t> challenge(challengeSize, 0x5a);
+			ByteSpan data;
+			data.data = challenge.data();
+			data.size = challenge.size();
+
+			counter->commands = 0;
+			counter->reports = 0;
+			ByteArray response;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < signs; ++i) {
+				response.Clear();
+				if (!signer.Sign(ident, data, response, CancelFlag())) {
+					fprintf(stderr, "sign of %u bytes failed\n", (unsigned)challengeSize);
+					return 1;
+				}
+			}
+			std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+			printf("%8u %8u %12.1f %12.1f %12.0f\n", (unsigned)challengeSize, (unsigned)payload,
+				(double)counter->commands / signs, (double)counter->reports / signs, elapsed.count() / signs);
+		}
+	}
+
+	return 0;
+}
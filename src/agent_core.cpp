@@ -0,0 +1,786 @@
+#include "agent_core.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <memory>
+#include <thread>
+#include "apdu_status.h"
+#include "logger.h"
+#include "encodeUtil.h"
+#include "stringUtil.h"
+
+// size of an uncompressed public key answer: length, 0x04, x, y
+constexpr size_t pubKeyResponseSize = 66;
+
+// host scoped key listings and sign histories kept before starting over
+constexpr size_t maxScopedAnswers = 256;
+constexpr size_t maxHostHistories = 1024;
+
+// keys added by clients sign in microseconds, their queue takes bursts
+constexpr size_t softwareMaxQueued = 4096;
+constexpr size_t softwareMaxPerClient = 1024;
+
+// seconds after which a sign success weighs half
+constexpr double priorityHalfLife = 7 * 24 * 3600.0;
+
+const std::string sessionBindExtension = "session-bind@openssh.com";
+const std::string ecdhExtension = "ecdh@ledger.com";
+
+static bool IsExtension(const ByteSpan& name, const std::string& extension) {
+	return name.size == extension.size() && memcmp(name.data, extension.data(), name.size) == 0;
+}
+
+AgentCore::AgentCore(DevicePool& devices, IdentityStore& identities)
+	: mDevices(devices)
+	, mIdentities(identities)
+	, mDeviceSigner(devices)
+	, mStartTime(std::chrono::steady_clock::now())
+	, mSoftwareScheduler(softwareMaxQueued, softwareMaxPerClient) {
+	// one device operation per device at a time, keys in memory on every core
+	const size_t numCores = std::thread::hardware_concurrency();
+	mSoftwareScheduler.SetConcurrency(numCores > 0 ? numCores : 1);
+	mDevices.SetDevicesChanged([this](size_t numDevices) {
+		mScheduler.SetConcurrency(numDevices > 0 ? numDevices : 1);
+	});
+}
+
+AgentCore::~AgentCore() {
+	mDevices.SetDevicesChanged(DevicePool::DevicesChanged());
+}
+
+void AgentCore::HandleRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response) {
+	std::promise<void> signature;
+	std::future<void> finished = signature.get_future();
+	Completion done = [&response, &signature](const SharedResponse& signResponse) {
+		response = signResponse;
+		signature.set_value();
+	};
+
+	if (!SubmitRequest(client, request, length, response, done)) {
+		finished.wait();
+	}
+}
+
+bool AgentCore::SubmitRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response, const Completion& done) {
+	KeyOperation operation;
+	if (AnswerFromCache(client, request, length, response, operation)) {
+		return true;
+	}
+
+	// the job outlives the request buffer
+	std::shared_ptr<std::vector<uint8_t>> data = std::make_shared<std::vector<uint8_t>>(operation.data.data, operation.data.data + operation.data.size);
+	std::shared_ptr<Identity> identity = std::make_shared<Identity>(operation.identity);
+
+	Signer* signer = operation.signer;
+	const bool isSoftwareKey = signer == &mSoftwareSigner;
+	SignScheduler& scheduler = isSoftwareKey ? mSoftwareScheduler : mScheduler;
+
+	const CancelFlag cancel = client.cancel;
+	const std::vector<uint8_t> hostKey = client.boundHostKey;
+	const size_t maxQueued = client.tenant ? client.tenant->maxQueued : 0;
+	bool queued = scheduler.Submit(client.id, [this, signer, isSoftwareKey, data, identity, hostKey, done, cancel](bool cancelled) {
+		if (cancelled) {
+			done(FailureResponse());
+			return;
+		}
+
+		if (signer == nullptr) {
+			done(Ecdh(*identity, *data, cancel));
+			return;
+		}
+
+		ByteSpan queuedChallenge;
+		queuedChallenge.data = data->data();
+		queuedChallenge.size = data->size();
+
+		ByteArray signResponse;
+		if (!signer->Sign(*identity, queuedChallenge, signResponse, cancel)) {
+			done(FailureResponse());
+			return;
+		}
+
+		// keys added by clients keep their order, their signatures are too
+		// frequent to rebuild the key listing for each
+		if (!isSoftwareKey) {
+			RecordSuccess(identity->pubkey_cached.Get(), hostKey);
+		}
+		done(std::make_shared<const std::vector<uint8_t>>(std::move(signResponse.Get())));
+	}, cancel, maxQueued);
+
+	if (!queued) {
+		response = FailureResponse();
+		return true;
+	}
+
+	return false;
+}
+
+bool AgentCore::HandleFastRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response) {
+	KeyOperation operation;
+	return AnswerFromCache(client, request, length, response, operation);
+}
+
+void AgentCore::SetKnownHosts(std::shared_ptr<const KnownHosts> knownHosts) {
+	std::lock_guard<std::mutex> lock(mCacheMutex);
+	mKnownHosts = knownHosts;
+	mScopedAnswers.clear();
+}
+
+bool AgentCore::AnswerFromCache(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response, KeyOperation& outOperation) {
+	response.reset();
+
+	SshReader reader(request, length);
+	uint32_t messageLength = 0;
+	if (!reader.ReadUint32(messageLength) || messageLength == 0) {
+		LOG_DBG("No identity was accepted");
+		return true;
+	}
+
+	if (messageLength > reader.Remaining()) {
+		LOG_ERR("Truncated agent request");
+		response = FailureResponse();
+		return true;
+	}
+
+	SshReader message(reader.Rest().data, messageLength);
+	uint8_t operation = 0;
+	message.ReadByte(operation);
+	if (operation == SSH2_AGENTC_REQUEST_IDENTITIES) {
+		response = PresentPubKeys(client);
+		return true;
+	}
+	else if (operation == SSH2_AGENTC_EXTENSION) {
+		// ECDH may need the device, the other extensions are answered here
+		SshReader extension = message;
+		ByteSpan name;
+		if (extension.ReadString(name) && IsExtension(name, ecdhExtension)) {
+			return AnswerEcdh(client, extension, response, outOperation);
+		}
+
+		response = HandleExtension(client, message);
+		return true;
+	}
+	else if (operation == SSH2_AGENTC_ADD_IDENTITY || operation == SSH2_AGENTC_REMOVE_IDENTITY || operation == SSH2_AGENTC_REMOVE_ALL_IDENTITIES) {
+		response = ChangeSoftwareKeys(client, operation, message);
+		return true;
+	}
+	else if (operation == SSH2_AGENTC_SIGN_REQUEST) {
+		// key blob, data, flags
+		ByteSpan keyBlob;
+		if (!message.ReadString(keyBlob) || !message.ReadString(outOperation.data)) {
+			response = FailureResponse();
+			return true;
+		}
+
+		// device keys first, as they are listed first
+		std::lock_guard<std::mutex> lock(mCacheMutex);
+		std::lock_guard<std::mutex> storeLock(mIdentities.GetMutex());
+		RefreshCache();
+		const bool restricted = client.tenant && !client.tenant->allowedIdentities.empty();
+		const Identity* ident = restricted ? FindAllowedIdentity(*client.tenant, keyBlob.data, keyBlob.size) : FindIdentity(keyBlob.data, keyBlob.size);
+		if (ident != nullptr) {
+			std::string identName = stringUtil::ws2s(ident->name);
+			LOG_DBG("Identity %s was accepted", identName.c_str());
+			outOperation.identity = *ident;
+			outOperation.signer = &mDeviceSigner;
+			return false;
+		}
+
+		if (!restricted && mSoftwareSigner.HasKey(keyBlob.data, keyBlob.size)) {
+			outOperation.identity.pubkey_cached.Get().assign(keyBlob.data, keyBlob.data + keyBlob.size);
+			outOperation.signer = &mSoftwareSigner;
+			return false;
+		}
+
+		LOG_ERR("Error: accepted key not found.");
+		response = FailureResponse();
+		return true;
+	}
+
+	LOG_DBG("Unknown Operation %d", operation);
+	response = FailureResponse();
+	return true;
+}
+
+ByteArray AgentCore::FetchPublicKey(const Identity& identity, uint16_t* statusCode) {
+	ByteArray path = identity.GetPathBIP32();
+
+	// APDU for public key ssh
+	APDU dataApdu(0x80, 0x02, 0x00, identity.keyType.GetP2(), path);
+
+	std::vector<DeviceWorker::Response> responses = mDevices.Broadcast(dataApdu);
+
+	// devices sharing a seed all answer with the same key
+	uint16_t status = CODE_NO_STATUS_RESULT;
+	ByteArray response;
+	for (const DeviceWorker::Response& deviceResponse : responses) {
+		if (!deviceResponse.valid) {
+			continue;
+		}
+
+		if (status == CODE_NO_STATUS_RESULT || deviceResponse.statusCode == CODE_SUCCESS) {
+			status = deviceResponse.statusCode;
+			response = deviceResponse.data;
+		}
+
+		if (status == CODE_SUCCESS) {
+			break;
+		}
+	}
+
+	*statusCode = status;
+	if (status != CODE_SUCCESS) {
+		return {};
+	}
+
+	ByteArray keyinfo = BuildKeyBlob(identity, response);
+	if (keyinfo.Empty()) {
+		return {};
+	}
+
+	// remember which devices hold this key for signing
+	for (size_t i = 0; i < responses.size(); ++i) {
+		if (responses[i].valid && responses[i].statusCode == status && responses[i].data == response) {
+			mDevices.AddAffinity(keyinfo, i);
+		}
+	}
+
+	return keyinfo;
+}
+
+ByteArray AgentCore::ConvertPubKey(const std::string& curveName, ByteArray& response) {
+	if (response.Size() != pubKeyResponseSize) {
+		return {};
+	}
+
+	if (curveName == "nistp256") {
+		ByteArray key;
+		// NIST256P1 compression: 0x03
+		if ((response[65] & 1) != 0) {
+			key.PushBack((uint8_t)0x03);
+		}
+		else {
+			key.PushBack((uint8_t)0x02);
+		}
+
+		// copy 32 response bytes
+		for (uint32_t idx = 2; idx < 34; ++idx) {
+			key.PushBack(response[idx]);
+		}
+		return key;
+	}
+	else if (curveName == "ed25519") {
+		ByteArray key;
+		for (uint32_t idx = response.Size() - 1; idx > 33; --idx) {
+			key.PushBack(response[idx]);
+		}
+		if ((response[33] & 1) != 0) {
+			key[31] |= 0x80;
+		}
+		return key;
+	}
+
+	return {};
+}
+
+ByteArray AgentCore::BuildKeyBlob(const Identity& identity, ByteArray& response) {
+	KeyType identKeyType = identity.keyType;
+	const std::string identKeyNameStr = identKeyType.GetName();
+	const std::string identKeyTypeStr = identKeyType.GetKeyType();
+
+	ByteArray key = ConvertPubKey(identKeyType.GetName(), response);
+	if (key.Empty()) {
+		return {};
+	}
+
+	ByteArray pubkeyDecompressed;
+	if (identKeyType.GetName() == "nistp256") {
+		ByteArray keyinfo;
+		// key header
+		keyinfo.PushBack((uint32_t)identKeyTypeStr.length());
+		keyinfo.PushBack((uint8_t*)identKeyTypeStr.data(), identKeyTypeStr.length());
+
+		/// curve name
+		keyinfo.PushBack((uint32_t)identKeyNameStr.length());
+		keyinfo.PushBack((uint8_t*)identKeyNameStr.data(), identKeyNameStr.length());
+
+		pubkeyDecompressed = encodeUtils::decompressPubKey(key);
+
+		keyinfo.PushBack((uint32_t)pubkeyDecompressed.Size() + 1);
+		keyinfo.PushBack((uint8_t)identKeyType.GetOctet());
+		keyinfo.PushBack(pubkeyDecompressed);
+		return keyinfo;
+	}
+	else if (identKeyType.GetName() == "ed25519") {
+		pubkeyDecompressed = encodeUtils::decompressPubKey_ed25519(key);
+
+		// key header
+		ByteArray keyinfo;
+		keyinfo.PushBack((uint32_t)strlen("ssh-ed25519"));
+		keyinfo.PushBack((uint8_t*)identKeyTypeStr.data(), identKeyTypeStr.length());
+
+		keyinfo.PushBack((uint32_t)pubkeyDecompressed.Size());
+		keyinfo.PushBack(pubkeyDecompressed);
+		return keyinfo;
+	}
+	else {
+		return {};
+	}
+}
+
+SignScheduler& AgentCore::GetScheduler() {
+	return mScheduler;
+}
+
+SignScheduler& AgentCore::GetSoftwareScheduler() {
+	return mSoftwareScheduler;
+}
+
+EcdhCache& AgentCore::GetEcdhCache() {
+	return mEcdhCache;
+}
+
+uint32_t AgentCore::GetNumLoadedKeys() {
+	std::lock_guard<std::mutex> lock(mCacheMutex);
+	std::lock_guard<std::mutex> storeLock(mIdentities.GetMutex());
+	RefreshCache();
+	return mNumLoadedKeys;
+}
+
+SharedResponse AgentCore::PresentPubKeys(const AgentClient& client) {
+	// only cached keys are offered, the device is not needed
+	std::lock_guard<std::mutex> lock(mCacheMutex);
+	std::lock_guard<std::mutex> storeLock(mIdentities.GetMutex());
+	RefreshCache();
+	if (mAnswerStale) {
+		mIdentitiesAnswer = BuildIdentitiesAnswer(mLoadedIdentities, true);
+		mAnswerStale = false;
+	}
+
+	const bool restricted = client.tenant && !client.tenant->allowedIdentities.empty();
+	if (client.boundHostKey.empty() && !restricted) {
+		return mIdentitiesAnswer;
+	}
+
+	std::string scope = restricted ? client.tenant->name : std::string();
+	scope.push_back('\0');
+	scope.append(client.boundHostKey.begin(), client.boundHostKey.end());
+	std::unordered_map<std::string, SharedResponse>::const_iterator it = mScopedAnswers.find(scope);
+	if (it != mScopedAnswers.end()) {
+		return it->second;
+	}
+
+	std::vector<size_t> allowed;
+	if (restricted) {
+		for (size_t index : mLoadedIdentities) {
+			if (IsAllowed(*client.tenant, mIdentities.GetIdentityByIndex(index))) {
+				allowed.push_back(index);
+			}
+		}
+	}
+	else {
+		allowed = mLoadedIdentities;
+	}
+
+	// identities for the host the client is authenticating to, in offer order
+	const std::string hostKey(client.boundHostKey.begin(), client.boundHostKey.end());
+	std::vector<size_t> scoped;
+	if (!hostKey.empty() && mKnownHosts && mKnownHosts->GetNumKeys() > 0) {
+		for (size_t index : allowed) {
+			const Identity& ident = mIdentities.GetIdentityByIndex(index);
+			if (mKnownHosts->Matches(client.boundHostKey.data(), client.boundHostKey.size(), stringUtil::ws2s(ident.host), ident.port)) {
+				scoped.push_back(index);
+			}
+		}
+	}
+
+	// an unknown host gets every allowed key, as without the binding,
+	// keys that signed for this host before go first
+	std::unordered_map<std::string, std::unordered_map<std::string, double>>::const_iterator history = mHostKeyPriorities.end();
+	if (!hostKey.empty()) {
+		history = mHostKeyPriorities.find(hostKey);
+	}
+
+	SharedResponse answer = mIdentitiesAnswer;
+	if (!scoped.empty() || history != mHostKeyPriorities.end() || restricted) {
+		if (scoped.empty()) {
+			scoped.swap(allowed);
+		}
+
+		if (history != mHostKeyPriorities.end()) {
+			const std::unordered_map<std::string, double>& priorities = history->second;
+			std::stable_sort(scoped.begin(), scoped.end(), [this, &priorities](size_t a, size_t b) {
+				return GetPriority(priorities, a) > GetPriority(priorities, b);
+			});
+		}
+
+		answer = BuildIdentitiesAnswer(scoped, !restricted);
+	}
+
+	if (mScopedAnswers.size() >= maxScopedAnswers) {
+		mScopedAnswers.clear();
+	}
+	mScopedAnswers[scope] = answer;
+	return answer;
+}
+
+SharedResponse AgentCore::HandleExtension(AgentClient& client, SshReader& message) {
+	ByteSpan name;
+	if (!message.ReadString(name) || !IsExtension(name, sessionBindExtension)) {
+		LOG_DBG("Unsupported extension");
+		return FailureResponse();
+	}
+
+	// host key, session identifier, signature, is forwarding
+	ByteSpan hostKey;
+	ByteSpan sessionId;
+	ByteSpan signature;
+	uint8_t forwarding = 0;
+	if (!message.ReadString(hostKey) || !message.ReadString(sessionId) || !message.ReadString(signature) || !message.ReadByte(forwarding)) {
+		return FailureResponse();
+	}
+
+	// like ssh-agent, a connection used for authentication is not bound again
+	if (!client.boundHostKey.empty() && !client.forwarding) {
+		LOG_WARN("Session already bound");
+		return FailureResponse();
+	}
+
+	// the signature is not checked: the binding only narrows which public keys
+	// are listed, signing is not restricted by it
+	client.boundHostKey.assign(hostKey.data, hostKey.data + hostKey.size);
+	client.forwarding = forwarding != 0;
+	return SuccessResponse();
+}
+
+SharedResponse AgentCore::ChangeSoftwareKeys(const AgentClient& client, uint8_t operation, SshReader& message) {
+	// the keys are seen by every client, a tenant must not add to what the others get
+	if (client.tenant) {
+		LOG_WARN("Tenant %s may not change keys", client.tenant->name.c_str());
+		return FailureResponse();
+	}
+
+	bool changed = false;
+	if (operation == SSH2_AGENTC_ADD_IDENTITY) {
+		changed = mSoftwareSigner.Add(message);
+	}
+	else if (operation == SSH2_AGENTC_REMOVE_IDENTITY) {
+		// device keys are not removed, they come back from the device anyway
+		ByteSpan keyBlob;
+		changed = message.ReadString(keyBlob) && mSoftwareSigner.Remove(keyBlob.data, keyBlob.size);
+	}
+	else {
+		mSoftwareSigner.RemoveAll();
+		changed = true;
+	}
+
+	return changed ? SuccessResponse() : FailureResponse();
+}
+
+bool AgentCore::AnswerEcdh(const AgentClient& client, SshReader& message, SharedResponse& response, KeyOperation& outOperation) {
+	// key blob of the identity, peer public key as an uncompressed point
+	ByteSpan keyBlob;
+	if (!message.ReadString(keyBlob) || !message.ReadString(outOperation.data) || outOperation.data.size == 0) {
+		response = FailureResponse();
+		return true;
+	}
+
+	{
+		// keys added by clients have no decryption key
+		std::lock_guard<std::mutex> lock(mCacheMutex);
+		std::lock_guard<std::mutex> storeLock(mIdentities.GetMutex());
+		RefreshCache();
+		const bool restricted = client.tenant && !client.tenant->allowedIdentities.empty();
+		const Identity* ident = restricted ? FindAllowedIdentity(*client.tenant, keyBlob.data, keyBlob.size) : FindIdentity(keyBlob.data, keyBlob.size);
+		if (ident == nullptr) {
+			LOG_ERR("Error: ECDH key not found.");
+			response = FailureResponse();
+			return true;
+		}
+		outOperation.identity = *ident;
+	}
+
+	std::vector<uint8_t> secret;
+	if (mEcdhCache.Find(GetEcdhCacheKey(outOperation.identity, outOperation.data.data, outOperation.data.size), secret)) {
+		LOG_DBG("ECDH answered from the cache");
+		response = BuildEcdhResponse(secret);
+		return true;
+	}
+
+	outOperation.signer = nullptr;
+	return false;
+}
+
+SharedResponse AgentCore::Ecdh(const Identity& ident, const std::vector<uint8_t>& peerKey, const CancelFlag& cancel) {
+	// a request queued behind one with the same peer key needs no confirmation
+	const std::string cacheKey = GetEcdhCacheKey(ident, peerKey.data(), peerKey.size());
+	std::vector<uint8_t> secret;
+	if (mEcdhCache.Find(cacheKey, secret)) {
+		return BuildEcdhResponse(secret);
+	}
+
+	// decryption keys are derived under purpose 17'
+	ByteArray data = ident.GetPathBIP32(true);
+	data.Get().insert(data.Get().end(), peerKey.begin(), peerKey.end());
+	const uint8_t p2 = ident.keyType.GetP2();
+	DevicePool::CommandBuilder buildCommand = [&](size_t) {
+		return std::vector<APDU>{ APDU(0x80, 0x0A, 0x00, p2, data) };
+	};
+
+	DeviceWorker::Response deviceResponse = mDevices.Exchange(buildCommand, ident.pubkey_cached, cancel);
+	if (!deviceResponse.valid || deviceResponse.statusCode != CODE_SUCCESS || deviceResponse.data.Empty()) {
+		return FailureResponse();
+	}
+
+	mEcdhCache.Insert(cacheKey, deviceResponse.data.Get());
+	return BuildEcdhResponse(deviceResponse.data.Get());
+}
+
+std::string AgentCore::GetEcdhCacheKey(const Identity& ident, const uint8_t* peerKey, size_t length) {
+	// the key blob tells the device seed apart, path and curve the key on it
+	const std::vector<uint8_t>& keyBlob = ident.pubkey_cached.Get();
+	const ByteArray path = ident.GetPathBIP32(true);
+	std::vector<uint8_t> key;
+	SshWriter writer(key);
+	writer.WriteString(keyBlob.data(), keyBlob.size());
+	writer.WriteString(path.Get().data(), path.Size());
+	writer.WriteByte(ident.keyType.GetP2());
+	writer.WriteString(peerKey, length);
+	return std::string(key.begin(), key.end());
+}
+
+SharedResponse AgentCore::BuildEcdhResponse(const std::vector<uint8_t>& secret) {
+	// SSH_AGENT_SUCCESS, string shared point
+	ByteArray response;
+	SshWriter writer(response.Get());
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH_AGENT_SUCCESS);
+	writer.WriteString(secret.data(), secret.size());
+	writer.EndLength(messageStart);
+	return std::make_shared<const std::vector<uint8_t>>(std::move(response.Get()));
+}
+
+void AgentCore::RefreshCache() {
+	const uint64_t generation = mIdentities.GetGeneration();
+	const uint64_t softwareGeneration = mSoftwareSigner.GetGeneration();
+	if (mCacheValid && generation == mCacheGeneration && softwareGeneration == mSoftwareGeneration) {
+		return;
+	}
+
+	mKeyIndex.clear();
+	mKeyIndex.reserve(mIdentities.GetNumIdentities());
+	mLoadedIdentities.clear();
+	mScopedAnswers.clear();
+
+	for (size_t i = 0; i < mIdentities.GetNumIdentities(); ++i) {
+		const Identity& ident = mIdentities.GetIdentityByIndex(i);
+
+		// skip unloaded
+		if (ident.pubkey_cached.Empty()) {
+			continue;
+		}
+
+		mLoadedIdentities.push_back(i);
+
+		// the first identity with a key answers for it, like the list order
+		const std::vector<uint8_t>& key = ident.pubkey_cached.Get();
+		if (FindIdentity(key.data(), key.size()) == nullptr) {
+			mKeyIndex.insert(std::make_pair(HashKeyBlob(key.data(), key.size()), i));
+		}
+	}
+
+	// the only full sort, successes later move single keys
+	std::stable_sort(mLoadedIdentities.begin(), mLoadedIdentities.end(), [this](size_t a, size_t b) {
+		return GetPriority(mKeyPriorities, a) > GetPriority(mKeyPriorities, b);
+	});
+
+	mSoftwareKeys = mSoftwareSigner.GetKeys();
+	mIdentitiesAnswer = BuildIdentitiesAnswer(mLoadedIdentities, true);
+	mAnswerStale = false;
+	mNumLoadedKeys = (uint32_t)(mLoadedIdentities.size() + mSoftwareKeys.size());
+	mCacheGeneration = generation;
+	mSoftwareGeneration = softwareGeneration;
+	mCacheValid = true;
+}
+
+SharedResponse AgentCore::BuildIdentitiesAnswer(const std::vector<size_t>& indices, bool withSoftwareKeys) {
+	// length is filled in once known
+	std::vector<uint8_t> answer;
+	SshWriter writer(answer);
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH2_AGENT_IDENTITIES_ANSWER);
+	writer.WriteUint32((uint32_t)(indices.size() + (withSoftwareKeys ? mSoftwareKeys.size() : 0)));
+
+	for (size_t index : indices) {
+		const Identity& ident = mIdentities.GetIdentityByIndex(index);
+
+		// key, comment
+		const std::vector<uint8_t>& key = ident.pubkey_cached.Get();
+		writer.WriteString(key.data(), key.size());
+		writer.WriteString(ident.ToString());
+	}
+
+	if (withSoftwareKeys) {
+		for (const SoftwareSigner::Key& key : mSoftwareKeys) {
+			writer.WriteString(key.blob.data(), key.blob.size());
+			writer.WriteString(key.comment);
+		}
+	}
+
+	writer.EndLength(messageStart);
+	return std::make_shared<const std::vector<uint8_t>>(std::move(answer));
+}
+
+void AgentCore::RecordSuccess(const std::vector<uint8_t>& keyBlob, const std::vector<uint8_t>& hostKey) {
+	// successes count half after a week: log2(2^p + 2^now)
+	const double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStartTime).count() / priorityHalfLife;
+	const std::string key(keyBlob.begin(), keyBlob.end());
+	auto addSuccess = [now](std::unordered_map<std::string, double>& priorities, const std::string& key) {
+		std::unordered_map<std::string, double>::iterator it = priorities.find(key);
+		if (it == priorities.end()) {
+			priorities[key] = now;
+			return now;
+		}
+
+		it->second = std::max(it->second, now) + std::log2(1.0 + std::exp2(-std::fabs(it->second - now)));
+		return it->second;
+	};
+
+	// the identities may have changed while the device was signing,
+	// the indices below must be those of the current store
+	std::lock_guard<std::mutex> lock(mCacheMutex);
+	std::lock_guard<std::mutex> storeLock(mIdentities.GetMutex());
+	RefreshCache();
+
+	if (!hostKey.empty()) {
+		if (mHostKeyPriorities.size() >= maxHostHistories) {
+			mHostKeyPriorities.clear();
+		}
+		const std::string host(hostKey.begin(), hostKey.end());
+		addSuccess(mHostKeyPriorities[host], key);
+
+		// listings for this host follow its history; scopes are tenant name, zero, host key
+		for (std::unordered_map<std::string, SharedResponse>::iterator it = mScopedAnswers.begin(); it != mScopedAnswers.end();) {
+			const size_t separator = it->first.find('\0');
+			if (separator != std::string::npos && it->first.compare(separator + 1, std::string::npos, host) == 0) {
+				it = mScopedAnswers.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+	const double priority = addSuccess(mKeyPriorities, key);
+
+	// move the key up past those that signed less, the rest keeps its order
+	std::vector<size_t>::iterator position = mLoadedIdentities.begin();
+	while (position != mLoadedIdentities.end() && mIdentities.GetIdentityByIndex(*position).pubkey_cached.Get() != keyBlob) {
+		++position;
+	}
+	if (position == mLoadedIdentities.end()) {
+		return;
+	}
+
+	bool moved = false;
+	while (position != mLoadedIdentities.begin() && GetPriority(mKeyPriorities, *(position - 1)) < priority) {
+		std::iter_swap(position, position - 1);
+		--position;
+		moved = true;
+	}
+
+	// most successes are of a key already in front, they change no listing
+	if (moved) {
+		mAnswerStale = true;
+		mScopedAnswers.clear();
+	}
+}
+
+double AgentCore::GetPriority(const std::unordered_map<std::string, double>& priorities, size_t identityIndex) const {
+	const std::vector<uint8_t>& key = mIdentities.GetIdentityByIndex(identityIndex).pubkey_cached.Get();
+	std::unordered_map<std::string, double>::const_iterator it = priorities.find(std::string(key.begin(), key.end()));
+	return it != priorities.end() ? it->second : -HUGE_VAL;
+}
+
+const Identity* AgentCore::FindIdentity(const uint8_t* keyBlob, size_t length) {
+	// only identities with a loaded key are indexed
+	typedef std::unordered_multimap<uint64_t, size_t>::const_iterator Iterator;
+	std::pair<Iterator, Iterator> range = mKeyIndex.equal_range(HashKeyBlob(keyBlob, length));
+	for (Iterator it = range.first; it != range.second; ++it) {
+		const Identity& ident = mIdentities.GetIdentityByIndex(it->second);
+		const std::vector<uint8_t>& key = ident.pubkey_cached.Get();
+		if (key.size() == length && memcmp(key.data(), keyBlob, length) == 0) {
+			return &ident;
+		}
+	}
+
+	return nullptr;
+}
+
+const Identity* AgentCore::FindAllowedIdentity(const AgentTenant& tenant, const uint8_t* keyBlob, size_t length) {
+	// an identity sharing the key with an earlier one may be the allowed one
+	for (size_t index : mLoadedIdentities) {
+		const Identity& ident = mIdentities.GetIdentityByIndex(index);
+		const std::vector<uint8_t>& key = ident.pubkey_cached.Get();
+		if (key.size() == length && memcmp(key.data(), keyBlob, length) == 0 && IsAllowed(tenant, ident)) {
+			return &ident;
+		}
+	}
+
+	return nullptr;
+}
+
+bool AgentCore::IsAllowed(const AgentTenant& tenant, const Identity& ident) {
+	if (tenant.allowedIdentities.empty()) {
+		return true;
+	}
+
+	for (const Identity& allowed : tenant.allowedIdentities) {
+		// no protocol means ssh, as in the address the key is derived from
+		const bool sameProtocol = allowed.protocol == ident.protocol ||
+			(allowed.protocol.empty() && ident.protocol == L"ssh") || (allowed.protocol == L"ssh" && ident.protocol.empty());
+		if (sameProtocol && allowed.user == ident.user && allowed.host == ident.host && allowed.port == ident.port && allowed.path == ident.path) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint64_t AgentCore::HashKeyBlob(const uint8_t* keyBlob, size_t length) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < length; ++i) {
+		hash ^= keyBlob[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+void AgentCore::Failure(ByteArray& response) {
+	response.Clear();
+	SshWriter writer(response.Get());
+	writer.WriteUint32(1);
+	writer.WriteByte((uint8_t)SSH_AGENT_FAILURE);
+}
+
+const SharedResponse& AgentCore::SuccessResponse() {
+	static const SharedResponse success = []() {
+		ByteArray response;
+		SshWriter writer(response.Get());
+		writer.WriteUint32(1);
+		writer.WriteByte((uint8_t)SSH_AGENT_SUCCESS);
+		return std::make_shared<const std::vector<uint8_t>>(std::move(response.Get()));
+	}();
+	return success;
+}
+
+const SharedResponse& AgentCore::FailureResponse() {
+	static const SharedResponse failure = []() {
+		ByteArray response;
+		Failure(response);
+		return std::make_shared<const std::vector<uint8_t>>(std::move(response.Get()));
+	}();
+	return failure;
+}
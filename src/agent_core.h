@@ -0,0 +1,211 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "bytearray.h"
+#include "device_pool.h"
+#include "device_signer.h"
+#include "ecdh_cache.h"
+#include "identity.h"
+#include "known_hosts.h"
+#include "sign_scheduler.h"
+#include "software_signer.h"
+#include "ssh_wire.h"
+
+// SSH
+#define SSH_AGENT_FAILURE 5
+#define SSH_AGENT_SUCCESS 6
+#define SSH2_AGENTC_REQUEST_IDENTITIES 11
+#define SSH2_AGENT_IDENTITIES_ANSWER 12
+#define SSH2_AGENTC_SIGN_REQUEST 13
+#define SSH2_AGENT_SIGN_RESPONSE 14
+#define SSH2_AGENTC_ADD_IDENTITY 17
+#define SSH2_AGENTC_REMOVE_IDENTITY 18
+#define SSH2_AGENTC_REMOVE_ALL_IDENTITIES 19
+#define SSH2_AGENTC_EXTENSION 27
+
+// Identities offered by the agent, kept by the application or the headless driver.
+class IdentityStore {
+public:
+	virtual ~IdentityStore() {
+	}
+
+	virtual size_t GetNumIdentities() const = 0;
+	virtual const Identity& GetIdentityByIndex(size_t index) const = 0;
+
+	// changes whenever an identity is added, edited or removed, or a key loaded or cleared
+	virtual uint64_t GetGeneration() const = 0;
+
+	// held by the agent while it reads identities, the owner holds it while it changes them
+	std::mutex& GetMutex() const {
+		return mMutex;
+	}
+
+private:
+	mutable std::mutex mMutex;
+};
+
+// framed response, immutable so one buffer can be sent to any number of clients
+typedef std::shared_ptr<const std::vector<uint8_t>> SharedResponse;
+
+// Restrictions shared by the clients of one relay socket.
+struct AgentTenant {
+	// unique among the tenants of an agent
+	std::string name;
+	// identities offered and usable, matched by address (any curve), empty allows all
+	std::vector<Identity> allowedIdentities;
+	// sign requests waiting at once, zero for the scheduler default
+	size_t maxQueued = 0;
+	// open connections, zero for no limit
+	size_t maxConnections = 0;
+	// only this peer user may connect, -1 for any on a socket file and for
+	// the agent's own user on an abstract socket
+	long uid = -1;
+};
+
+// State of one client connection, kept by the transport.
+struct AgentClient {
+	// picks the sign queue
+	uint64_t id = 0;
+	// relay tenant the client connected as, null when unrestricted
+	std::shared_ptr<const AgentTenant> tenant;
+	// set once the client went away
+	CancelFlag cancel;
+	// host key from session-bind@openssh.com, key listings are scoped to its host
+	std::vector<uint8_t> boundHostKey;
+	bool forwarding = false;
+};
+
+// SSH agent protocol handling without any window, file mapping or registry.
+// Takes a complete request, length prefix included, and produces the framed
+// response, talking to the devices in the pool for keys and signatures.
+// Signatures go through a scheduler that serves clients round-robin.
+// Keys added by clients are held in memory and signed with on a pool of
+// their own, they never wait behind a device confirmation.
+// The ecdh@ledger.com extension has the device derive an ECDH shared secret
+// with the identity's decryption key, for PGP style decryption.
+class AgentCore {
+public:
+	// gets the response of a queued request, on a scheduler thread
+	typedef std::function<void(const SharedResponse& response)> Completion;
+
+	AgentCore(DevicePool& devices, IdentityStore& identities);
+	~AgentCore();
+
+	// response is left null when nothing should be sent back;
+	// blocks until a signature is made
+	void HandleRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response);
+
+	// answers into response and returns true unless the request is queued for
+	// signing, then done is called later; a full queue is answered with a failure,
+	// as is a request cancelled before its signature was made
+	bool SubmitRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response, const Completion& done);
+
+	// fast path: answers whatever needs no device (key listing, extensions, cached ECDH secrets, failures)
+	// from cached state without copying it; returns false for requests that must go to HandleRequest
+	bool HandleFastRequest(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response);
+
+	// host keys that session-bind is matched against, bound clients are
+	// offered the identities of their host only, or all allowed when none matches
+	void SetKnownHosts(std::shared_ptr<const KnownHosts> knownHosts);
+
+	// identities with a loaded key and keys added by clients, as offered to clients
+	uint32_t GetNumLoadedKeys();
+
+	// key blob for the identity as served by the device, empty on failure
+	ByteArray FetchPublicKey(const Identity& identity, uint16_t* statusCode);
+
+	// queue bounds and counters of the sign queue in front of the devices
+	SignScheduler& GetScheduler();
+
+	// sign queue of the keys added by clients
+	SignScheduler& GetSoftwareScheduler();
+
+	// shared secrets of earlier ECDH requests
+	EcdhCache& GetEcdhCache();
+
+	// framed SSH_AGENT_FAILURE
+	static const SharedResponse& FailureResponse();
+
+	static ByteArray ConvertPubKey(const std::string& curveName, ByteArray& response);
+	static ByteArray BuildKeyBlob(const Identity& identity, ByteArray& response);
+
+private:
+	// a request that needs a key, run on a scheduler thread
+	struct KeyOperation {
+		// makes the signature, null for ECDH on the device
+		Signer* signer = nullptr;
+		Identity identity;
+		// data to sign or peer public key, in the request buffer
+		ByteSpan data;
+	};
+
+	// answers the request and returns true unless it needs a key, then fills outOperation
+	bool AnswerFromCache(AgentClient& client, const uint8_t* request, size_t length, SharedResponse& response, KeyOperation& outOperation);
+
+	SharedResponse PresentPubKeys(const AgentClient& client);
+	SharedResponse HandleExtension(AgentClient& client, SshReader& message);
+	// answers from the cache and returns true, or false when the device is needed
+	bool AnswerEcdh(const AgentClient& client, SshReader& message, SharedResponse& response, KeyOperation& outOperation);
+	SharedResponse Ecdh(const Identity& ident, const std::vector<uint8_t>& peerKey, const CancelFlag& cancel);
+	static std::string GetEcdhCacheKey(const Identity& ident, const uint8_t* peerKey, size_t length);
+	static SharedResponse BuildEcdhResponse(const std::vector<uint8_t>& secret);
+	SharedResponse ChangeSoftwareKeys(const AgentClient& client, uint8_t operation, SshReader& message);
+	void RefreshCache();
+	// the identities at indices, then the keys added by clients when withSoftwareKeys
+	SharedResponse BuildIdentitiesAnswer(const std::vector<size_t>& indices, bool withSoftwareKeys);
+
+	// moves the key up the offer order, for the bound host too when there is one
+	void RecordSuccess(const std::vector<uint8_t>& keyBlob, const std::vector<uint8_t>& hostKey);
+	double GetPriority(const std::unordered_map<std::string, double>& priorities, size_t identityIndex) const;
+
+	const Identity* FindIdentity(const uint8_t* keyBlob, size_t length);
+	const Identity* FindAllowedIdentity(const AgentTenant& tenant, const uint8_t* keyBlob, size_t length);
+	static bool IsAllowed(const AgentTenant& tenant, const Identity& ident);
+	static uint64_t HashKeyBlob(const uint8_t* keyBlob, size_t length);
+
+	static void Failure(ByteArray& response);
+	static const SharedResponse& SuccessResponse();
+
+	DevicePool& mDevices;
+	IdentityStore& mIdentities;
+	DeviceSigner mDeviceSigner;
+	SoftwareSigner mSoftwareSigner;
+
+	// rebuilt together when the store generation moves:
+	// the framed SSH2_AGENT_IDENTITIES_ANSWER and key blob hash -> identity index;
+	// a new answer replaces the old one, which lives on while it is being sent;
+	// taken before the store mutex
+	std::mutex mCacheMutex;
+	SharedResponse mIdentitiesAnswer;
+	// a success moved a key, the answer is rebuilt at the next listing
+	bool mAnswerStale = false;
+	// identities with a key, in offer order
+	std::vector<size_t> mLoadedIdentities;
+	// keys added by clients, offered after the identities in the order added
+	std::vector<SoftwareSigner::Key> mSoftwareKeys;
+	uint32_t mNumLoadedKeys = 0;
+
+	// decayed sign success counts by key blob, log2 scaled to the time of the
+	// success so they compare without decaying every key as time passes;
+	// kept across identity changes, and per bound host key
+	std::chrono::steady_clock::time_point mStartTime;
+	std::unordered_map<std::string, double> mKeyPriorities;
+	std::unordered_map<std::string, std::unordered_map<std::string, double>> mHostKeyPriorities;
+	// answers for bound or tenant clients by tenant name and host key
+	std::shared_ptr<const KnownHosts> mKnownHosts;
+	std::unordered_map<std::string, SharedResponse> mScopedAnswers;
+	std::unordered_multimap<uint64_t, size_t> mKeyIndex;
+	uint64_t mCacheGeneration = 0;
+	uint64_t mSoftwareGeneration = 0;
+	bool mCacheValid = false;
+
+	EcdhCache mEcdhCache;
+
+	// last, so their threads stop before anything they use goes away
+	SignScheduler mScheduler;
+	SignScheduler mSoftwareScheduler;
+};
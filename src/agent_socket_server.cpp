@@ -0,0 +1,457 @@
+#include "agent_socket_server.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "logger.h"
+
+// epoll ids below the first connection id, one per listener from firstListenEventId on
+constexpr uint64_t wakeEventId = 0;
+constexpr uint64_t firstListenEventId = 1;
+
+constexpr int maxEvents = 64;
+constexpr size_t readChunkSize = 4096;
+
+// responses handed to one sendmsg call
+constexpr size_t maxWriteSegments = 16;
+
+// unsent responses of a client before its further requests wait
+constexpr size_t maxPendingResponses = 64;
+
+AgentSocketServer::AgentSocketServer(AgentCore& agent, const std::string& path)
+	: mAgent(agent)
+	, mRunning(false) {
+	if (!path.empty()) {
+		AddListener(path, nullptr);
+	}
+}
+
+AgentSocketServer::~AgentSocketServer() {
+	Stop();
+
+	// queued signatures still call back into this server, none is wanted any more
+	for (std::map<uint64_t, Connection>::value_type& entry : mConnections) {
+		entry.second.client.cancel->store(true);
+	}
+	{
+		std::unique_lock<std::mutex> lock(mCompletionMutex);
+		mCompletionCondition.wait(lock, [this]() { return mPendingSigns == 0; });
+	}
+
+	for (std::map<uint64_t, Connection>::value_type& entry : mConnections) {
+		close(entry.second.fd);
+	}
+
+	for (const Listener& listener : mListeners) {
+		if (listener.fd >= 0) {
+			close(listener.fd);
+			if (listener.path[0] != '@') {
+				unlink(listener.path.c_str());
+			}
+		}
+	}
+	if (mEpollFd >= 0) {
+		close(mEpollFd);
+	}
+	if (mWakeFd >= 0) {
+		close(mWakeFd);
+	}
+}
+
+void AgentSocketServer::AddListener(const std::string& path, std::shared_ptr<const AgentTenant> tenant) {
+	Listener listener;
+	listener.path = path;
+	listener.tenant = tenant;
+	if (tenant != nullptr && tenant->uid >= 0) {
+		listener.uid = tenant->uid;
+	}
+	else if (!path.empty() && path[0] == '@') {
+		// anyone on the host could connect otherwise
+		listener.uid = (long)geteuid();
+	}
+	mListeners.push_back(listener);
+}
+
+bool AgentSocketServer::Listen() {
+	if (mListeners.empty()) {
+		return false;
+	}
+
+	for (Listener& listener : mListeners) {
+		if (!Bind(listener)) {
+			return false;
+		}
+	}
+
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEpollFd < 0 || mWakeFd < 0) {
+		return false;
+	}
+
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = wakeEventId;
+	epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event);
+	for (size_t i = 0; i < mListeners.size(); ++i) {
+		event.data.u64 = firstListenEventId + i;
+		epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mListeners[i].fd, &event);
+	}
+	mNextConnectionId = firstListenEventId + mListeners.size();
+
+	mRunning = true;
+	return true;
+}
+
+bool AgentSocketServer::Bind(Listener& listener) {
+	const std::string& path = listener.path;
+	const bool isAbstract = path[0] == '@';
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		LOG_ERR("Socket path too long: %s", path.c_str());
+		return false;
+	}
+	memcpy(address.sun_path, path.c_str(), path.size());
+
+	// abstract names start with a zero byte and are exactly as long as given
+	socklen_t addressSize = sizeof(address);
+	if (isAbstract) {
+		address.sun_path[0] = '\0';
+		addressSize = (socklen_t)(offsetof(sockaddr_un, sun_path) + path.size());
+	}
+
+	listener.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener.fd < 0) {
+		return false;
+	}
+
+	// a stale socket from an earlier run would make bind fail, abstract ones go with their owner
+	if (!isAbstract) {
+		unlink(path.c_str());
+	}
+	if (bind(listener.fd, (const sockaddr*)&address, addressSize) != 0 ||
+		(!isAbstract && chmod(path.c_str(), S_IRUSR | S_IWUSR) != 0) || listen(listener.fd, SOMAXCONN) != 0) {
+		LOG_ERR("Could not listen on %s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+void AgentSocketServer::Run() {
+	epoll_event events[maxEvents];
+	while (mRunning) {
+		int numEvents = epoll_wait(mEpollFd, events, maxEvents, -1);
+		if (numEvents < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			LOG_ERR("epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < numEvents; ++i) {
+			const uint64_t id = events[i].data.u64;
+			if (id >= firstListenEventId && id < firstListenEventId + mListeners.size()) {
+				Accept((size_t)(id - firstListenEventId));
+				continue;
+			}
+
+			if (id == wakeEventId) {
+				uint64_t count = 0;
+				ssize_t ignored = read(mWakeFd, &count, sizeof(count));
+				(void)ignored;
+				DrainCompletions();
+				continue;
+			}
+
+			std::map<uint64_t, Connection>::iterator it = mConnections.find(id);
+			if (it == mConnections.end()) {
+				continue;
+			}
+
+			if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) {
+				OnReadable(id, it->second);
+				it = mConnections.find(id);
+			}
+			if (it != mConnections.end() && (events[i].events & EPOLLOUT) != 0) {
+				// room for the responses of requests held back
+				OnWritable(id, it->second);
+				it = mConnections.find(id);
+				if (it != mConnections.end() && !it->second.input.empty()) {
+					Dispatch(id, it->second);
+				}
+			}
+		}
+	}
+}
+
+void AgentSocketServer::Stop() {
+	mRunning = false;
+	if (mWakeFd >= 0) {
+		uint64_t one = 1;
+		ssize_t ignored = write(mWakeFd, &one, sizeof(one));
+		(void)ignored;
+	}
+}
+
+void AgentSocketServer::Accept(size_t listenerIndex) {
+	Listener& listener = mListeners[listenerIndex];
+	while (true) {
+		int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				LOG_WARN("accept failed: %s", strerror(errno));
+			}
+			return;
+		}
+
+		ucred credentials;
+		socklen_t size = sizeof(credentials);
+		if (listener.uid >= 0 && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0 || (long)credentials.uid != listener.uid)) {
+			LOG_WARN("Client of %s refused, wrong user", listener.path.c_str());
+			close(fd);
+			continue;
+		}
+
+		const AgentTenant* tenant = listener.tenant.get();
+		if (tenant != nullptr) {
+			if (tenant->maxConnections != 0 && listener.numConnections >= tenant->maxConnections) {
+				LOG_WARN("Client of tenant %s refused, %u connected", tenant->name.c_str(), (unsigned)listener.numConnections);
+				close(fd);
+				continue;
+			}
+		}
+
+		const uint64_t id = mNextConnectionId++;
+		Connection& connection = mConnections[id];
+		connection.fd = fd;
+		connection.listener = listenerIndex;
+		connection.client.cancel = MakeCancelFlag();
+		connection.client.tenant = listener.tenant;
+		if (tenant != nullptr) {
+			// all clients of a tenant share its sign queue, apart from process groups and unknown peers
+			connection.client.id = (std::hash<std::string>()(tenant->name) & ~(3ull << 62u)) | 1ull << 62u;
+		}
+		else {
+			connection.client.id = GetClientId(fd, id);
+		}
+		listener.numConnections++;
+
+		epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.u64 = id;
+		if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+			CloseConnection(id);
+		}
+	}
+}
+
+void AgentSocketServer::OnReadable(uint64_t id, Connection& connection) {
+	uint8_t buffer[readChunkSize];
+	while (true) {
+		ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+		if (received > 0) {
+			connection.input.insert(connection.input.end(), buffer, buffer + received);
+
+			// a client may pipeline requests, but not more than one maximum request ahead
+			if (connection.input.size() > 2 * (agentMaxRequest + 4)) {
+				LOG_WARN("Client sent too much data");
+				CloseConnection(id);
+				return;
+			}
+			continue;
+		}
+
+		if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+
+		// closed by the client or failed, a response still being made is dropped
+		CloseConnection(id);
+		return;
+	}
+
+	Dispatch(id, connection);
+}
+
+void AgentSocketServer::OnWritable(uint64_t id, Connection& connection) {
+	while (!connection.output.empty()) {
+		// the queued responses as they are, the first one partly sent
+		iovec segments[maxWriteSegments];
+		size_t numSegments = 0;
+		for (std::deque<SharedResponse>::const_iterator it = connection.output.begin(); it != connection.output.end() && numSegments < maxWriteSegments; ++it) {
+			const size_t offset = numSegments == 0 ? connection.outputOffset : 0;
+			segments[numSegments].iov_base = const_cast<uint8_t*>((*it)->data() + offset);
+			segments[numSegments].iov_len = (*it)->size() - offset;
+			numSegments++;
+		}
+
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = segments;
+		message.msg_iovlen = numSegments;
+		ssize_t sent = sendmsg(connection.fd, &message, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			CloseConnection(id);
+			return;
+		}
+
+		size_t remaining = (size_t)sent;
+		while (remaining > 0) {
+			const size_t left = connection.output.front()->size() - connection.outputOffset;
+			if (remaining < left) {
+				connection.outputOffset += remaining;
+				break;
+			}
+
+			remaining -= left;
+			connection.output.pop_front();
+			connection.outputOffset = 0;
+		}
+	}
+
+	UpdateEvents(id, connection);
+}
+
+void AgentSocketServer::Dispatch(uint64_t id, Connection& connection) {
+	// responses go out in order, so nothing is taken while a signature is pending,
+	// nor while the client is not reading what it asked for
+	while (!connection.busy && connection.output.size() < maxPendingResponses && connection.input.size() >= 4) {
+		const uint8_t* header = connection.input.data();
+		const uint32_t length = static_cast<uint32_t>(header[0]) << 24u | static_cast<uint32_t>(header[1]) << 16u |
+			static_cast<uint32_t>(header[2]) << 8u | static_cast<uint32_t>(header[3]);
+		if (length > agentMaxRequest) {
+			LOG_WARN("Request of %u bytes rejected", length);
+			CloseConnection(id);
+			return;
+		}
+
+		const size_t requestSize = 4 + (size_t)length;
+		if (connection.input.size() < requestSize) {
+			break;
+		}
+
+		// key listing and failures are answered right here, only signing is queued
+		SharedResponse response;
+		bool answered = mAgent.SubmitRequest(connection.client, connection.input.data(), requestSize, response, [this, id](const SharedResponse& signResponse) {
+			std::lock_guard<std::mutex> lock(mCompletionMutex);
+			Completion completion;
+			completion.connectionId = id;
+			completion.response = signResponse;
+			mCompletions.push_back(std::move(completion));
+
+			uint64_t one = 1;
+			ssize_t ignored = write(mWakeFd, &one, sizeof(one));
+			(void)ignored;
+
+			mPendingSigns--;
+			mCompletionCondition.notify_all();
+		});
+		connection.input.erase(connection.input.begin(), connection.input.begin() + requestSize);
+
+		if (answered) {
+			if (response && !response->empty()) {
+				connection.output.push_back(response);
+			}
+			continue;
+		}
+
+		// the signature may already be done, the count only has to settle before closing
+		connection.busy = true;
+		std::lock_guard<std::mutex> lock(mCompletionMutex);
+		mPendingSigns++;
+	}
+
+	if (!connection.output.empty()) {
+		OnWritable(id, connection);
+	}
+}
+
+void AgentSocketServer::DrainCompletions() {
+	std::vector<Completion> completions;
+	{
+		std::lock_guard<std::mutex> lock(mCompletionMutex);
+		completions.swap(mCompletions);
+	}
+
+	for (Completion& completion : completions) {
+		std::map<uint64_t, Connection>::iterator it = mConnections.find(completion.connectionId);
+		if (it == mConnections.end()) {
+			continue;
+		}
+
+		Connection& connection = it->second;
+		connection.busy = false;
+		if (completion.response && !completion.response->empty()) {
+			connection.output.push_back(std::move(completion.response));
+		}
+
+		// takes the next pipelined request and sends what is ready
+		Dispatch(completion.connectionId, connection);
+	}
+}
+
+void AgentSocketServer::UpdateEvents(uint64_t id, Connection& connection) {
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	if (!connection.output.empty()) {
+		event.events |= EPOLLOUT;
+	}
+	event.data.u64 = id;
+	epoll_ctl(mEpollFd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void AgentSocketServer::CloseConnection(uint64_t id) {
+	std::map<uint64_t, Connection>::iterator it = mConnections.find(id);
+	if (it == mConnections.end()) {
+		return;
+	}
+
+	it->second.client.cancel->store(true);
+	mListeners[it->second.listener].numConnections--;
+	epoll_ctl(mEpollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+	close(it->second.fd);
+	mConnections.erase(it);
+}
+
+uint64_t AgentSocketServer::GetClientId(int fd, uint64_t connectionId) {
+	// process group of the peer, shared by the processes of one shell job
+	ucred credentials;
+	socklen_t size = sizeof(credentials);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.pid > 0) {
+		pid_t group = getpgid(credentials.pid);
+		return (uint64_t)(group > 0 ? group : credentials.pid);
+	}
+
+	// unknown peers each get their own queue, apart from any process group
+	return connectionId | 1ull << 63u;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "agent_core.h"
+
+// largest request accepted from a client, the same bound OpenSSH uses
+constexpr uint32_t agentMaxRequest = 256 * 1024;
+
+// SSH_AUTH_SOCK compatible listener on a Unix domain socket (Linux only).
+// One epoll thread accepts clients and does all socket I/O non-blocking.
+// Requests answered from cached state are served on that thread, signing is
+// queued on the agent's sign scheduler so a client waiting on a device
+// confirmation does not hold up the others.
+// Connections from one process group share a sign queue, so a batch job
+// running many ssh processes is one client to the scheduler.
+// Each client gets its responses in request order. Responses of any size are
+// written straight from the agent's buffers as the socket takes them, a key
+// listing shared by many clients is never copied per client.
+// As a relay it listens on one socket per tenant (container, VM) besides or
+// instead of its own; clients of a tenant share one sign queue and only see
+// the identities the tenant is allowed.
+class AgentSocketServer {
+public:
+	// path may be empty when only tenant sockets are served
+	AgentSocketServer(AgentCore& agent, const std::string& path);
+	~AgentSocketServer();
+
+	// another socket, before Listen; a path starting with '@' is in the
+	// abstract namespace and only takes clients of the tenant's uid, or of
+	// the agent's user when it has none; tenant may be null
+	void AddListener(const std::string& path, std::shared_ptr<const AgentTenant> tenant);
+
+	bool Listen();
+
+	// serves clients until Stop is called, safe to call from a signal handler
+	void Run();
+	void Stop();
+
+private:
+	struct Listener {
+		std::string path;
+		int fd = -1;
+		std::shared_ptr<const AgentTenant> tenant;
+		size_t numConnections = 0;
+		// only this peer user may connect, -1 for any; abstract sockets have
+		// no file permissions, they default to the agent's own user
+		long uid = -1;
+	};
+
+	struct Connection {
+		int fd = -1;
+		size_t listener = 0;
+		// its cancel flag is set on close so a queued signature is not made for nobody
+		AgentClient client;
+		std::vector<uint8_t> input;
+		// responses not yet sent, the first one from outputOffset on
+		std::deque<SharedResponse> output;
+		size_t outputOffset = 0;
+		bool busy = false;
+	};
+
+	struct Completion {
+		uint64_t connectionId;
+		SharedResponse response;
+	};
+
+	bool Bind(Listener& listener);
+	void Accept(size_t listenerIndex);
+	void OnReadable(uint64_t id, Connection& connection);
+	void OnWritable(uint64_t id, Connection& connection);
+	void Dispatch(uint64_t id, Connection& connection);
+	void DrainCompletions();
+	void UpdateEvents(uint64_t id, Connection& connection);
+	void CloseConnection(uint64_t id);
+	static uint64_t GetClientId(int fd, uint64_t connectionId);
+
+	AgentCore& mAgent;
+	// event id of each is its index plus firstListenEventId
+	std::vector<Listener> mListeners;
+
+	int mEpollFd = -1;
+	int mWakeFd = -1;
+	std::atomic<bool> mRunning;
+
+	// set above the listener event ids by Listen
+	uint64_t mNextConnectionId = 0;
+	std::map<uint64_t, Connection> mConnections;
+
+	// signatures still queued or being made, waited for before closing
+	std::mutex mCompletionMutex;
+	std::condition_variable mCompletionCondition;
+	std::vector<Completion> mCompletions;
+	int mPendingSigns = 0;
+};
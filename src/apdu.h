@@ -1,19 +1,33 @@
 #pragma once
 
+#include <vector>
 #include "bytearray.h"
 
+constexpr size_t packet_size = 64;
 constexpr uint16_t APDU_CHANNEL = 0x0101;
 constexpr uint8_t APDU_TAG = 0x05;
 
+// payload limits: one length byte, or 0x00 followed by two length bytes
+// bounded by the two byte message length of the HID framing
+constexpr size_t shortPayloadMax = 0xFF;
+constexpr size_t extendedPayloadMax = 0xFFFF - 7;
+
 class APDU {
 public:
 	APDU(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const ByteArray& data)
+		: APDU(cla, ins, p1, p2, data.Get().data(), data.Size()) {
+	}
+
+	// a payload longer than extendedPayloadMax leaves the APDU invalid and empty
+	APDU(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t* data, size_t length)
 		: mInstructionClass(cla)
 		, mInstruction(ins)
 		, mParameter1(p1)
 		, mParameter2(p2)
-		, mPayloadSize((uint8_t)data.Size() & 0xFF) {
-		memcpy(mPayload, data.Get().data(), data.Size());
+		, mValid(length <= extendedPayloadMax) {
+		if (mValid) {
+			mPayload.assign(data, data + length);
+		}
 	}
 
 	~APDU() {
@@ -21,25 +35,58 @@ public:
 	}
 
 	ByteArray AsBytes() const {
-		ByteArray out;
-		out.PushBack(mInstructionClass);
-		out.PushBack(mInstruction);
-		out.PushBack(mParameter1);
-		out.PushBack(mParameter2);
-		out.PushBack(mPayloadSize);
-
-		if (mPayloadSize > 0) {
-			out.PushBack((uint8_t*)mPayload, mPayloadSize);
+		ByteArray out(SerializedSize());
+		CopyTo(0, out.Get().data(), out.Size());
+		return out;
+	}
+
+	// invalid APDUs are refused instead of being sent
+	bool IsValid() const {
+		return mValid;
+	}
+
+	bool IsExtended() const {
+		return mPayload.size() > shortPayloadMax;
+	}
+
+	size_t SerializedSize() const {
+		return HeaderSize() + mPayload.size();
+	}
+
+	// copies serialized bytes [offset, offset + length) without building the whole command
+	void CopyTo(size_t offset, uint8_t* out, size_t length) const {
+		const size_t headerSize = HeaderSize();
+		while (length > 0 && offset < headerSize) {
+			*out++ = HeaderByte(offset++);
+			length--;
 		}
 
-		return out;
+		if (length > 0) {
+			memcpy(out, mPayload.data() + (offset - headerSize), length);
+		}
 	}
 
 private:
+	size_t HeaderSize() const {
+		return IsExtended() ? 7 : 5;
+	}
+
+	uint8_t HeaderByte(size_t index) const {
+		switch (index) {
+		case 0: return mInstructionClass;
+		case 1: return mInstruction;
+		case 2: return mParameter1;
+		case 3: return mParameter2;
+		case 4: return IsExtended() ? 0x00 : (uint8_t)mPayload.size();
+		case 5: return (uint8_t)(mPayload.size() >> 8u);
+		default: return (uint8_t)mPayload.size();
+		}
+	}
+
 	uint8_t mInstructionClass = 0x00;
 	uint8_t mInstruction = 0x00;
 	uint8_t mParameter1 = 0x00;
 	uint8_t mParameter2 = 0x00;
-	uint8_t mPayloadSize = 0;
-	uint8_t mPayload[0xFF];
+	bool mValid = true;
+	std::vector<uint8_t> mPayload;
 };
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// status words answered by the dongle, the last two bytes of every response
+constexpr uint16_t CODE_SUCCESS = 0x9000;
+constexpr uint16_t CODE_USER_REJECTED = 0x6985;
+constexpr uint16_t CODE_WRONG_LENGTH = 0x6700;
+constexpr uint16_t CODE_INVALID_DATA = 0x6a80;
+constexpr uint16_t CODE_INVALID_PARAM = 0x6b01;
+
+// returned when the SSH/PGP app is not the one running
+constexpr uint16_t CODE_INS_NOT_SUPPORTED = 0x6d00;
+constexpr uint16_t CODE_CLA_NOT_SUPPORTED = 0x6e00;
+
+// no response came back at all
+constexpr uint16_t CODE_NO_STATUS_RESULT = CODE_SUCCESS + 1;
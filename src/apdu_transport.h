@@ -0,0 +1,39 @@
+#pragma once
+
+#include "apdu.h"
+#include "bytearray.h"
+
+// time the user gets to confirm on the device
+constexpr int userTimeoutMs = 15000;
+
+struct ApduResponse {
+	bool valid = false;
+	uint16_t statusCode = 0;
+	ByteArray data;
+};
+
+// Carries complete APDUs to a device and back.
+// HidTransport frames them into HID reports, other transports may hand them
+// over as they are.
+class ApduTransport {
+public:
+	virtual ~ApduTransport() {
+	}
+
+	virtual bool Open() = 0;
+	virtual void Close() = 0;
+	virtual bool IsOpen() const = 0;
+
+	// whether the SSH/PGP app was found running, reset on close
+	virtual bool IsAppReady() const = 0;
+	virtual void SetAppReady(bool ready) = 0;
+
+	// fills outResponse, its data buffer is reused so a response passed in
+	// again does not allocate; returns false when no response came back
+	virtual bool Exchange(const APDU& apdu, ApduResponse& outResponse) = 0;
+
+	// largest APDU payload the device takes, see HidBackend::GetMaxPayload
+	virtual size_t GetMaxPayload() const {
+		return shortPayloadMax;
+	}
+};
@@ -1,32 +1,46 @@
 #include "application.h"
 
+#include <functional>
+#include <thread>
+#include "apdu_status.h"
 #include "logger.h"
 #include "encodeUtil.h"
 #include "stringUtil.h"
 
-// dongle response
-constexpr uint16_t CODE_SUCCESS = 0x9000;
-constexpr uint16_t CODE_USER_REJECTED = 0x6985;
-constexpr uint16_t CODE_INVALID_PARAM = 0x6b01;
-constexpr uint16_t CODE_NO_STATUS_RESULT = CODE_SUCCESS + 1;
+// runs job on another thread while this one keeps dispatching messages sent
+// from other processes, so other clients' WM_COPYDATA is answered meanwhile
+static void RunServingSentMessages(const std::function<void()>& job) {
+	HANDLE done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (done == NULL) {
+		job();
+		return;
+	}
 
+	std::thread worker([&job, done]() {
+		job();
+		SetEvent(done);
+	});
 
-constexpr uint32_t readOffset = 1;
-constexpr size_t headerSize = 5;
-constexpr size_t headerExtra = 2;
-constexpr size_t maxDataSize = packet_size - (headerSize + headerExtra);
+	while (true) {
+		DWORD result = MsgWaitForMultipleObjects(1, &done, FALSE, INFINITE, QS_SENDMESSAGE);
+		if (result != WAIT_OBJECT_0 + 1) {
+			break;
+		}
 
-// SSH
-#define SSH_AGENT_FAILURE 5
-#define SSH2_AGENTC_REQUEST_IDENTITIES 11
-#define SSH2_AGENT_IDENTITIES_ANSWER 12
-#define SSH2_AGENTC_SIGN_REQUEST 13
-#define SSH2_AGENT_SIGN_RESPONSE 14
+		// dispatches pending sent messages only, posted ones wait for the main loop
+		MSG msg;
+		PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+	}
 
+	worker.join();
+	CloseHandle(done);
+}
 
 Application::Application()
 	: mIsDeviceConnected(false)
-	, mDevice() {
+	, mIdentitiesGeneration(0)
+	, mDevicePool()
+	, mAgent(mDevicePool, *this) {
 }
 
 Application::~Application() {
@@ -36,13 +50,16 @@ Application::~Application() {
 void Application::Init() {
 	InitKeyTypes();
 	LoadIdentities();
+
+	// connect to already plugged in devices
+	mDevicePool.Refresh();
 }
 
 bool Application::TryOpenDevice() {
 	bool success = true;
 
 	// if we arent ready prompt user to connect
-	while (!mDevice.Open()) {
+	while (!mDevicePool.Open()) {
 		LPCWSTR title = L"Ledger - Pageant";
 		LPCWSTR description = L"Could not connect with SSH/PGP Agent on Ledger Nano S";
 
@@ -56,217 +73,31 @@ bool Application::TryOpenDevice() {
 	return success;
 }
 
-ByteArray Application::WrapApdu(const APDU& command) {
-	constexpr uint32_t packetSize = 64;
-
-	ByteArray commandBytes = command.AsBytes();
-
-	uint16_t sequenceIdx = 0;
-	uint32_t offset = 0;
-
-	ByteArray result;
-	result.PushBack((uint16_t)APDU_CHANNEL);
-	result.PushBack((uint8_t)APDU_TAG);
-	result.PushBack((uint16_t)sequenceIdx);
-	result.PushBack((uint16_t)commandBytes.Size());
-
-	sequenceIdx++;
-
-	uint32_t blockSize = commandBytes.Size();
-	if (commandBytes.Size() > maxDataSize) {
-		blockSize = maxDataSize;
-	}
-
-	for (uint32_t i = 0; i < blockSize; ++i) {
-		result.PushBack(commandBytes[i + offset]);
-	}
-	offset = offset + blockSize;
-
-	while (offset != commandBytes.Size()) {
-		result.PushBack((uint16_t)APDU_CHANNEL);
-		result.PushBack((uint8_t)APDU_TAG);
-		result.PushBack((uint16_t)sequenceIdx);
-
-		sequenceIdx++;
-
-		blockSize = commandBytes.Size() - offset;
-		if ((commandBytes.Size() - offset) > packetSize - 3 - headerExtra) {
-			blockSize = packetSize - 3 - headerExtra;
-		}
-
-		for (uint32_t i = 0; i < blockSize; ++i) {
-			result.PushBack(command.AsBytes()[i + offset]);
-		}
-
-		offset = offset + blockSize;
-
-		// padding with 0 to meet packet Size
-		while (result.Size() % packetSize != 0) {
-			result.PushBack((uint8_t)0);
-		}
-	}
-
-	return result;
+void Application::OnDeviceArrival() {
+	mDevicePool.Refresh();
 }
 
-ByteArray Application::UnwrapApdu(ByteArray& data) {
-	uint32_t sequenceIdx = 0;
-	uint32_t offset = 0;
-
-	const uint32_t dataLen = data.Size();
-	if (dataLen < 5 + headerExtra + 5) {
-		LOG_ERR("Data size smaller than header.");
-		return {};
-	}
-
-	if (data.AsShort(offset) != APDU_CHANNEL) {
-		LOG_ERR("Invalid APDU channel");
-		return {};
-	}
-	offset += 2;
-
-	if (data.AsByte(offset) != APDU_TAG) {
-		LOG_ERR("Invalid APDU tag");
-		return {};
-	}
-	offset += 1;
-
-	if (data.AsShort(offset) != sequenceIdx) {
-		LOG_ERR("Invalid APDU sequence");
-		return {};
-	}
-	offset += 2;
-
-	uint32_t responseLength = data.AsShort(offset);
-	offset += 2;
-
-	if (data.Size() < 5 + headerExtra + responseLength) {
-		// We're waiting for another frame
-		return {};
-	}
-
-	const uint32_t packetSize = 64;
-	uint32_t blockSize = responseLength;
-	if (responseLength > packetSize - 5 - headerExtra) {
-		blockSize = packetSize - 5 - headerExtra;
-	}
-
-	ByteArray result;
-	for (uint32_t i = 0; i < blockSize; ++i) {
-		result.PushBack(data[offset + i]);
-	}
-	offset += blockSize;
-
-	while (result.Size() != responseLength) {
-		sequenceIdx++;
-
-		if (offset == data.Size()) {
-			LOG_ERR("Invalid data size");
-			return {};
-		}
-
-		if (data.AsShort(offset) != APDU_CHANNEL) {
-			LOG_ERR("Invalid APDU channel");
-			return {};
-		}
-		offset += 2;
-
-		if (data.AsByte(offset) != APDU_TAG) {
-			LOG_ERR("Invalid APDU tag");
-			return {};
-		}
-		offset += 1;
-
-		if (data.AsShort(offset) != sequenceIdx) {
-			LOG_ERR("Invalid APDU sequence");
-			return {};
-		}
-		offset += 2;
-
-		blockSize = responseLength - result.Size();
-		if (responseLength - result.Size() > packetSize - 3 - headerExtra) {
-			blockSize = packetSize - 3 - headerExtra;
-		}
-
-		for (uint32_t i = 0; i < blockSize; ++i) {
-			result.PushBack(data[offset + i]);
-		}
-
-		offset += blockSize;
-	}
-
-	return result;
+void Application::OnDeviceRemoval() {
+	mDevicePool.Refresh();
 }
 
-ByteArray Application::Exchange(const APDU& apdu, uint16_t* statusCode) {
-	ByteArray apdu_data = WrapApdu(apdu);
-
-	uint32_t padSize = apdu_data.Size() % 64;
-	if (padSize != 0) {
-		for (uint32_t i = 0; i < (64 - padSize); ++i) {
-			apdu_data.PushBack((uint8_t)0);
-		}
-	}
-
-	if (apdu_data.Size() % 64 != 0) {
-		LOG_ERR("padding not 64 byte aligned.");
-		return {};
-	}
-
-
-	uint32_t offset = 0;
-	while (offset != apdu_data.Size()) {
-		ByteArray data;
-		data.PushBack((uint8_t)0);
-		for (uint32_t i = 0; i < 64; ++i) {
-			data.PushBack(apdu_data[offset + i]);
-		}
-
-		if (mDevice.Write(data) < 0) {
-			LOG_ERR("Error while writing to device");
-			return {};
-		}
-
-		offset += 64;
-	}
-
-	uint32_t dataLength = 0;
-
-	ByteArray result;
-	if (mDevice.Read(result, 15) == 0) {
-		return {};
-	}
-
-	uint32_t swOffset = 0;
-	while (true) {
-		ByteArray response = UnwrapApdu(result);
-		uint32_t responseLen = response.Size();
-		if (responseLen) {
-			result = response;
-			swOffset = responseLen - 2;
-			dataLength = responseLen - 2;
-			break;
-		}
-
-		ByteArray readBytes;
-		mDevice.Read(readBytes);
-		result.PushBack(readBytes);
-	}
-
-	// return status code
-	*statusCode = result.AsShort(swOffset);
+void Application::AttachDevice(std::unique_ptr<HidBackend> backend) {
+	mDevicePool.Attach(std::move(backend));
+}
 
-	// return
-	ByteArray response;
-	for (uint32_t i = 0; i < dataLength; ++i) {
-		response.PushBack(result[i]);
-	}
+void Application::AttachDevice(std::unique_ptr<ApduTransport> transport) {
+	mDevicePool.Attach(std::move(transport));
+}
 
-	return response;
+void Application::RecordDevices(const std::string& tracePath) {
+	mDevicePool.SetTracePath(tracePath);
 }
 
 void Application::LoadIdentities() {
-	mIdentities = mRegistry.getSessions();
+	std::vector<Identity> identities = mRegistry.getSessions();
+	std::lock_guard<std::mutex> lock(GetMutex());
+	mIdentities.swap(identities);
+	MarkIdentitiesChanged();
 	LOG_DBG("Loaded %d identities", mIdentities.size());
 }
 
@@ -282,8 +113,14 @@ Identity& Application::GetIdentityByIndex(size_t index) {
 	return mIdentities[index];
 }
 
+const Identity& Application::GetIdentityByIndex(size_t index) const {
+	return mIdentities[index];
+}
+
 size_t Application::AddIdentity(Identity& inIdent) {
+	std::lock_guard<std::mutex> lock(GetMutex());
 	mIdentities.push_back(inIdent);
+	MarkIdentitiesChanged();
 	return mIdentities.size() - 1;
 }
 
@@ -291,7 +128,9 @@ bool Application::RemoveIdentityByIndex(size_t index) {
 	if (index < mIdentities.size()) {
 		if (mRegistry.removeSession(mIdentities[index])) {
 			// remove from list if removed from registry
+			std::lock_guard<std::mutex> lock(GetMutex());
 			mIdentities.erase(mIdentities.begin() + index);
+			MarkIdentitiesChanged();
 			return true;
 		}
 	}
@@ -306,15 +145,27 @@ bool Application::SaveIdentity(Identity& identity) {
 	}
 
 	mRegistry.createSession(identity);
+	MarkIdentitiesChanged();
 
 	std::string identName = stringUtil::ws2s(identity.name);
 	LOG_DBG("Saved identity: %s", identName.c_str());
 	return true;
 }
 
+void Application::UpdateIdentity(Identity& identity, const Identity& changed) {
+	std::lock_guard<std::mutex> lock(GetMutex());
+	identity = changed;
+	MarkIdentitiesChanged();
+}
+
+void Application::SetPubKey(Identity& identity, const ByteArray& keyBlob) {
+	std::lock_guard<std::mutex> lock(GetMutex());
+	identity.pubkey_cached = keyBlob;
+	MarkIdentitiesChanged();
+}
+
 void Application::InitKeyTypes() {
-	mKeyTypes.push_back(KeyType("nistp256", "ecdsa-sha2-", 0x04, 0x01));
-	mKeyTypes.push_back(KeyType("ed25519", "ssh-", 0x04, 0x02));
+	mKeyTypes = GetSupportedKeyTypes();
 }
 
 size_t Application::GetNumKeyTypes() {
@@ -337,48 +188,16 @@ size_t Application::GetKeyTypeIndexByName(const std::string& name) {
 	return -1;
 }
 
-uint32_t Application::GetNumLoadedKeys() {
-	uint32_t numKeys = 0;
-	for (uint32_t i = 0; i < mIdentities.size(); ++i) {
-		Identity ident = mIdentities[i];
-		if (!ident.pubkey_cached.Empty()) {
-			numKeys++;
-		}
-	}
-	return numKeys;
+void Application::MarkIdentitiesChanged() {
+	mIdentitiesGeneration++;
 }
 
-ByteArray Application::ConvertPubKey(const std::string& CurveName, ByteArray& response) {
-	assert(response.Size() == 66);
-
-	if(CurveName == "nistp256") {
-		ByteArray key;
-		// NIST256P1 compression: 0x03
-		if ((response[65] & 1) != 0) {
-			key.PushBack((uint8_t)0x03);
-		}
-		else {
-			key.PushBack((uint8_t)0x02);
-		}
-
-		// copy 32 response bytes
-		for (uint32_t idx = 2; idx < 34; ++idx) {
-			key.PushBack(response[idx]);
-		}
-		return key;
-	}
-	else if (CurveName == "ed25519") {
-		ByteArray key;
-		for(uint32_t idx = response.Size()-1; idx > 33; --idx) {
-			key.PushBack(response[idx]);
-		}
-		if ((response[33] & 1) != 0) {
-			key[31] |= 0x80;
-		}
-		return key;
-	}
+uint64_t Application::GetGeneration() const {
+	return mIdentitiesGeneration;
+}
 
-	return {};
+uint32_t Application::GetNumLoadedKeys() {
+	return mAgent.GetNumLoadedKeys();
 }
 
 ByteArray Application::GetPubKeyFor(const Identity& identity) {
@@ -386,20 +205,15 @@ ByteArray Application::GetPubKeyFor(const Identity& identity) {
 		return {};
 	}
 
-	ByteArray path = identity.GetPathBIP32();
-
-	// APDU for public key ssh
-	APDU dataApdu(0x80, 0x02, 0x00, identity.keyType.GetP2(), path);
-
-	uint16_t status = CODE_SUCCESS;
-	ByteArray response = Exchange(dataApdu, &status);
+	uint16_t status = CODE_NO_STATUS_RESULT;
+	ByteArray keyinfo = mAgent.FetchPublicKey(identity, &status);
 
 	std::string possibleCause = "";
-	if (status != 0x9000 && (status & 0xFF00) != 0x6100 && (status & 0xFF00) != 0x6C00) {
+	if (status != CODE_SUCCESS && (status & 0xFF00) != 0x6100 && (status & 0xFF00) != 0x6C00) {
 		possibleCause = "Unknown reason, Ledger not connected?";
 		if (status == 0x6982)
 			possibleCause = "Have you uninstalled the existing CA with resetCustomCA first?";
-		if (status == 0x6985) {
+		if (status == CODE_USER_REJECTED) {
 			possibleCause = "Condition of use not satisfied (denied by the user?)";
 			return ByteArray();
 		}
@@ -409,56 +223,16 @@ ByteArray Application::GetPubKeyFor(const Identity& identity) {
 			possibleCause = "Maybe this app requires a library to be installed first?";
 		if (status == 0x6484)
 			possibleCause = "Are you using the correct targetId?";
-		if (status == 0x6d00)
+		if (status == CODE_INS_NOT_SUPPORTED)
 			possibleCause = "Unexpected state of device: verify that the right application is opened?";
-		if (status == 0x6e00)
+		if (status == CODE_CLA_NOT_SUPPORTED)
 			possibleCause = "Unexpected state of device: verify that the right application is opened?";
 
 		LOG_ERR("Exchange status error: %s", possibleCause.c_str());
 		return ByteArray();
 	}
 
-
-	KeyType identKeyType = identity.keyType;
-	const std::string identKeyNameStr = identKeyType.GetName();
-	const std::string identKeyTypeStr = identKeyType.GetKeyType();
-
-	ByteArray key = ConvertPubKey(identKeyType.GetName(), response);
-
-	ByteArray pubkeyDecompressed;
-	if (identKeyType.GetName() == "nistp256") {
-		ByteArray keyinfo;
-		// key header
-		keyinfo.PushBack((uint32_t)identKeyTypeStr.length());
-		keyinfo.PushBack((uint8_t*)identKeyTypeStr.data(), identKeyTypeStr.length());
-
-		/// curve name
-		keyinfo.PushBack((uint32_t)identKeyNameStr.length());
-		keyinfo.PushBack((uint8_t*)identKeyNameStr.data(), identKeyNameStr.length());
-
-		pubkeyDecompressed = encodeUtils::decompressPubKey(key);
-
-		keyinfo.PushBack((uint32_t)pubkeyDecompressed.Size() + 1);
-		keyinfo.PushBack((uint8_t)identKeyType.GetOctet());
-		keyinfo.PushBack(pubkeyDecompressed);
-		return keyinfo;
-	}
-	else if (identKeyType.GetName() == "ed25519") {
-		pubkeyDecompressed = encodeUtils::decompressPubKey_ed25519(key);
-	
-		// key header
-		ByteArray keyinfo;
-		keyinfo.PushBack((uint32_t)strlen("ssh-ed25519"));
-		keyinfo.PushBack((uint8_t*)identKeyTypeStr.data(), identKeyTypeStr.length());
-
-		keyinfo.PushBack((uint32_t)pubkeyDecompressed.Size());
-		//keyinfo.PushBack((uint8_t)identKeyType.GetOctet());
-		keyinfo.PushBack(pubkeyDecompressed);
-		return keyinfo;
-	}
-	else {
-		return {};
-	}
+	return keyinfo;
 }
 
 std::string Application::GetPubKeyStrFor(const ByteArray& keyBlob, const Identity& identity) {
@@ -478,8 +252,8 @@ std::string Application::GetPubKeyStrFor(const ByteArray& keyBlob, const Identit
 }
 
 MemoryMap& Application::GetOrCreateMap(const std::string& identifier) {
-	std::vector<MemoryMap>::iterator iterator = mMemoryMaps.begin();
-	std::vector<MemoryMap>::iterator itEnd = mMemoryMaps.end();
+	std::deque<MemoryMap>::iterator iterator = mMemoryMaps.begin();
+	std::deque<MemoryMap>::iterator itEnd = mMemoryMaps.end();
 	for (iterator; iterator != itEnd; ++iterator) {
 		if ((*iterator).GetName() == identifier) {
 			return *iterator;
@@ -492,213 +266,60 @@ MemoryMap& Application::GetOrCreateMap(const std::string& identifier) {
 
 bool Application::HandleMemoryMap(MemoryMap& inMap) {
 	inMap.Open();
-	inMap.Seek(0);
 
-	uint32_t operationOffset = inMap.ReadInt();
-	if (operationOffset == 0) {
+	// the request is parsed in place, the response overwrites it once complete
+	SshReader reader(inMap.GetData(), inMap.GetSize());
+	uint32_t length = 0;
+	if (!reader.ReadUint32(length) || length == 0) {
 		LOG_DBG("No identity was accepted");
+		inMap.Close();
 		return false;
 	}
-	else if (operationOffset > 1) {
-		// Unclear where this clamp comes from
-		operationOffset = 1;
-	}
-
-	uint8_t operation = *inMap.ReadBytes(operationOffset);
-	if (operation == SSH2_AGENTC_REQUEST_IDENTITIES) {
-		PresentPubKeys(inMap);
-		return true;
-	}
-	else if (operation == SSH2_AGENTC_SIGN_REQUEST) {
-		bool foundKey = false;
-		Identity ident;
-
-		// first data after the 13 is the public key itself.
-		for (uint32_t i = 0; i < GetNumIdentities(); ++i) {
-			// start at offset
-			inMap.Seek(4 + operationOffset);
-
-			uint32_t keyLen = inMap.ReadInt();
-
-			// if this identity is loaded (has a key)
-			Identity curIdent = GetIdentityByIndex(i);
-			if (!curIdent.pubkey_cached.Empty()) {
-				// read map for key:
-				ByteArray mapArray;
-				mapArray.PushBack(inMap.ReadBytes(keyLen), keyLen);
-				if (curIdent.pubkey_cached == mapArray) {
-					foundKey = true;
-					ident = curIdent;
-					break;
-				}
-			}
-		}
-
-		if (!foundKey) {
-			LOG_ERR("Error: accepted key not found.");
-			ByteArray response;
-			response.PushBack((uint8_t)SSH_AGENT_FAILURE);
-
-			ByteArray agent_response;
-			agent_response.PushBack((uint32_t)response.Size());
-			agent_response.PushBack((uint8_t*)response.Get().data(), response.Size());
-
-			inMap.Seek(0);
-			inMap.Write(agent_response);
-			return false;
-		}
-
-		std::string identName = stringUtil::ws2s(ident.name);
-		LOG_DBG("Identity %s was accepted", identName.c_str());
-
-		SignMap(inMap, ident);
-
+	else if (length > reader.Remaining()) {
+		LOG_ERR("Agent request too large");
 		inMap.Close();
-		return true;
-	}
-	else {
-		LOG_DBG("Unknown Operation %s", operation);
+		return false;
 	}
 
-	return false;
-}
-
-void Application::PresentPubKeys(MemoryMap& inMap) {
-	// count identities that have keys loaded:
-	uint32_t numKeys = GetNumLoadedKeys();
-	if (numKeys == 0) {
+	if (inMap.GetData()[4] == SSH2_AGENTC_REQUEST_IDENTITIES && GetNumLoadedKeys() == 0) {
 		int msgboxID = MessageBox(NULL, L"No Identities have keys loaded, Please load Keys to continue.", L"Ledger Pageant", MB_ICONEXCLAMATION | MB_OK | MB_DEFBUTTON2);
 		if (msgboxID == IDOK) {
-			return;
-		}
-	}
-
-	if (!TryOpenDevice()) {
-		return;
-	}
-
-	ByteArray response;
-	response.PushBack((uint8_t)SSH2_AGENT_IDENTITIES_ANSWER);
-	response.PushBack((uint32_t)numKeys);
-
-	for (uint32_t i = 0; i < mIdentities.size(); ++i) {
-		Identity ident = mIdentities[i];
-
-		// skip unloaded
-		if (ident.pubkey_cached.Empty()) {
-			continue;
+			inMap.Close();
+			return false;
 		}
-
-		// key
-		response.PushBack((uint32_t)ident.pubkey_cached.Size());
-		response.PushBack((uint8_t*)ident.pubkey_cached.Get().data(), ident.pubkey_cached.Size());
-
-		// comment
-		std::string pathComment = ident.ToString();
-		response.PushBack((uint32_t)pathComment.length());
-		response.PushBack((uint8_t*)pathComment.data(), pathComment.length());
 	}
 
-	ByteArray agent_response;
-	agent_response.PushBack((uint32_t)response.Size());
-	agent_response.PushBack((uint8_t*)response.Get().data(), response.Size());
-
-	inMap.Seek(0);
-	inMap.Write(agent_response);
-}
-
-void Application::SignMap(MemoryMap& inMap, Identity& ident) {
-	// read challenge from map
-	size_t challenge_size = (size_t)inMap.ReadInt();
-	uint8_t* challenge = inMap.ReadBytes(challenge_size);
-
-	ByteArray challenge_blob;
-	challenge_blob.PushBack(challenge, challenge_size);
-
-	uint32_t offset = 0;
-	ByteArray signature;
-	uint32_t chunk_size = 0;
-	uint32_t challengeLen = challenge_blob.Size();
-	while (offset != challengeLen) {
-		ByteArray response_data;
-		if (offset == 0) {
-			ByteArray dongle_path = ident.GetPathBIP32();
-
-			for (uint32_t i = 0; i < dongle_path.Size(); ++i) {
-				response_data.PushBack(dongle_path[i]);
-			}
-		}
-
-		if ((challengeLen - offset) > (255 - response_data.Size())) {
-			chunk_size = (255 - response_data.Size());
-		}
-		else {
-			chunk_size = challengeLen - offset;
-		}
-
-		for (uint32_t i = offset; i < (offset + chunk_size); ++i) {
-			response_data.PushBack(challenge_blob[i]);
-		}
-
-		offset += chunk_size;
-
-		// challenge response apdu:
-		APDU dataApdu(0x80, 0x04, 0x00, 0x81, response_data);
+	// fast path from cached state; signing waits on the device without blocking
+	// other clients, whose requests re-enter here while this one is pending
+	const uint8_t* request = inMap.GetData();
+	const size_t requestSize = 4 + (size_t)length;
+	// clients name their map after the requesting thread, which makes it the sign queue
+	AgentClient client;
+	client.id = std::hash<std::string>()(inMap.GetName());
 
-		uint16_t status = CODE_SUCCESS;
-		signature = Exchange(dataApdu, &status);
-		if (status != CODE_SUCCESS) {
-			return;
-		}
+	SharedResponse response;
+	if (!mAgent.HandleFastRequest(client, request, requestSize, response)) {
+		RunServingSentMessages([this, request, requestSize, &response, &client]() {
+			mAgent.HandleRequest(client, request, requestSize, response);
+		});
 	}
 
-	offset = 3;
-
-	uint32_t length = signature[offset];
-	std::vector<uint8_t> r;
-	for (uint32_t i = offset + 1; i < offset + 1 + length; ++i) {
-		r.push_back(signature[i]);
+	if (!response || response->empty()) {
+		inMap.Close();
+		return false;
 	}
 
-	offset = offset + 1 + length + 1;
-	length = signature[offset];
-
-	std::vector<uint8_t> s;
-	for (uint32_t i = offset + 1; i < offset + 1 + length; ++i) {
-		if (i == offset + 1) {
-			if (signature[i] == 0) {
-				continue;
-			}
-		}
-
-		s.push_back(signature[i]);
+	// the client sized the map, an answer that does not fit is refused as a whole
+	inMap.Seek(0);
+	if (!inMap.Write(response->data(), response->size())) {
+		LOG_ERR("Agent response of %u bytes does not fit the %u byte map", (unsigned)response->size(), (unsigned)inMap.GetSize());
+		const SharedResponse& failure = AgentCore::FailureResponse();
+		inMap.Seek(0);
+		inMap.Write(failure->data(), failure->size());
+		inMap.Close();
+		return false;
 	}
 
-	ByteArray encoded_signature_value;
-	encoded_signature_value.PushBack((uint32_t)r.size());
-	encoded_signature_value.PushBack((uint8_t*)r.data(), r.size());
-
-	encoded_signature_value.PushBack((uint32_t)s.size());
-	encoded_signature_value.PushBack((uint8_t*)s.data(), s.size());
-
-	ByteArray encoded_signature;
-	const std::string keyType = ident.keyType.GetKeyType();
-	encoded_signature.PushBack((uint32_t)keyType.length());
-	encoded_signature.PushBack((uint8_t*)keyType.c_str(), keyType.size());
-
-	encoded_signature.PushBack((uint32_t)encoded_signature_value.Size());
-	encoded_signature.PushBack((uint8_t*)encoded_signature_value.Get().data(), encoded_signature_value.Size());
-
-	// < response
-	ByteArray response;
-	response.PushBack((uint8_t)SSH2_AGENT_SIGN_RESPONSE);
-	response.PushBack((uint32_t)encoded_signature.Size());
-	response.PushBack((uint8_t*)encoded_signature.Get().data(), encoded_signature.Size());
-
-	ByteArray agent_response;
-	agent_response.PushBack((uint32_t)response.Size());
-	agent_response.PushBack((uint8_t*)response.Get().data(), response.Size());
-
-	inMap.Seek(0);
-	inMap.Write(agent_response);
+	inMap.Close();
+	return (*response)[4] != SSH_AGENT_FAILURE;
 }
@@ -1,14 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <vector>
+#include "agent_core.h"
 #include "apdu.h"
 #include "identity.h"
 #include "key_type.h"
 #include "memoryMap.h"
-#include "ledger_device.h"
+#include "device_pool.h"
 #include "registryInterface.h"
 
-class Application {
+class Application : public IdentityStore {
 public:
 	Application();
 	~Application();
@@ -17,18 +20,25 @@ public:
 
 	// Device
 	bool TryOpenDevice();
-	ByteArray WrapApdu(const APDU& command);
-	ByteArray UnwrapApdu(ByteArray& data);
-	ByteArray Exchange(const APDU& apdu, uint16_t* statusCode);
+	void OnDeviceArrival();
+	void OnDeviceRemoval();
+	void AttachDevice(std::unique_ptr<HidBackend> backend);
+	void AttachDevice(std::unique_ptr<ApduTransport> transport);
+	void RecordDevices(const std::string& tracePath);
 
 	// Identity
 	void LoadIdentities();
 	std::vector<Identity>& GetIdentities();
-	size_t GetNumIdentities() const;
+	size_t GetNumIdentities() const override;
 	Identity& GetIdentityByIndex(size_t index);
+	const Identity& GetIdentityByIndex(size_t index) const override;
 	size_t AddIdentity(Identity& inIdent);
 	bool RemoveIdentityByIndex(size_t index);
 	bool SaveIdentity(Identity& identity);
+	// the agent may be reading the identities, so changes go through these
+	void UpdateIdentity(Identity& identity, const Identity& changed);
+	void SetPubKey(Identity& identity, const ByteArray& keyBlob);
+	uint64_t GetGeneration() const override;
 
 	// Public Key
 	void InitKeyTypes();
@@ -36,22 +46,25 @@ public:
 	KeyType GetKeyTypeByIndex(size_t index);
 	size_t GetKeyTypeIndexByName(const std::string& name);
 	uint32_t GetNumLoadedKeys();
-	ByteArray ConvertPubKey(const std::string& CurveName, ByteArray& response);
 	ByteArray GetPubKeyFor(const Identity& identity);
 	std::string GetPubKeyStrFor(const ByteArray& keyBlob, const Identity& identity);
 
 	// FileMap
 	MemoryMap& GetOrCreateMap(const std::string& identifier);
 	bool HandleMemoryMap(MemoryMap& inMap);
-	void PresentPubKeys(MemoryMap& map);
-	void SignMap(MemoryMap& map, Identity& ident);
 
 private:
-	bool mIsDeviceConnected = false;
-	Device mDevice;
-	RegistryInterface mRegistry;
+	void MarkIdentitiesChanged();
 
-	std::vector<MemoryMap> mMemoryMaps;
+	bool mIsDeviceConnected = false;
+	// declared before mAgent, which reads them from its scheduler threads until it is destroyed
 	std::vector<Identity> mIdentities;
+	std::atomic<uint64_t> mIdentitiesGeneration;
 	std::vector<KeyType> mKeyTypes;
+	DevicePool mDevicePool;
+	AgentCore mAgent;
+	RegistryInterface mRegistry;
+
+	// deque keeps references valid while a nested request adds a map
+	std::deque<MemoryMap> mMemoryMaps;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <cstring>
 #include <string>
 #include <vector>
 #include <algorithm>	// swap
@@ -15,6 +16,11 @@ public:
 		: mData(size) {
 	}
 
+	ByteArray(const ByteArray& other) = default;
+
+	// moved responses hand over their buffer
+	ByteArray(ByteArray&& other) = default;
+
 	~ByteArray() {
 
 	}
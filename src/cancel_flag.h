@@ -0,0 +1,16 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+// Shared by a queued request and its client, set once the answer is no longer wanted.
+// An empty flag never cancels.
+typedef std::shared_ptr<std::atomic<bool>> CancelFlag;
+
+inline CancelFlag MakeCancelFlag() {
+	return std::make_shared<std::atomic<bool>>(false);
+}
+
+inline bool IsCancelled(const CancelFlag& flag) {
+	return flag && flag->load();
+}
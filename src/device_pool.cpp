@@ -0,0 +1,208 @@
+#include "device_pool.h"
+
+#include <algorithm>
+#include "hid_trace.h"
+#include "logger.h"
+
+DevicePool::DevicePool() {
+}
+
+DevicePool::~DevicePool() {
+}
+
+void DevicePool::Refresh() {
+	std::vector<std::string> attached = HidApiBackend::Enumerate();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (size_t i = 0; i < mPaths.size(); ++i) {
+		// attached backends have no path and are never unplugged
+		if (mPaths[i].empty()) {
+			continue;
+		}
+
+		mPresent[i] = std::find(attached.begin(), attached.end(), mPaths[i]) != attached.end();
+		if (!mPresent[i]) {
+			mWorkers[i]->OnDeviceRemoval();
+		}
+		else {
+			mWorkers[i]->OnDeviceArrival();
+		}
+	}
+
+	// workers are never removed so device indices stay valid for the affinity map
+	for (const std::string& path : attached) {
+		if (std::find(mPaths.begin(), mPaths.end(), path) != mPaths.end()) {
+			continue;
+		}
+
+		LOG_DBG("Ledger attached: %s", path.c_str());
+		mPaths.push_back(path);
+		mPresent.push_back(true);
+		mWorkers.push_back(std::unique_ptr<DeviceWorker>(new DeviceWorker(Record(std::unique_ptr<HidBackend>(new HidApiBackend(path))))));
+		mWorkers.back()->OnDeviceArrival();
+	}
+
+	NotifyDevicesChanged();
+}
+
+void DevicePool::Attach(std::unique_ptr<HidBackend> backend) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPaths.push_back(std::string());
+	mPresent.push_back(true);
+	mWorkers.push_back(std::unique_ptr<DeviceWorker>(new DeviceWorker(Record(std::move(backend)))));
+	mWorkers.back()->OnDeviceArrival();
+	NotifyDevicesChanged();
+}
+
+void DevicePool::Attach(std::unique_ptr<ApduTransport> transport) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mPaths.push_back(std::string());
+	mPresent.push_back(true);
+	mWorkers.push_back(std::unique_ptr<DeviceWorker>(new DeviceWorker(std::move(transport))));
+	mWorkers.back()->OnDeviceArrival();
+	NotifyDevicesChanged();
+}
+
+void DevicePool::SetTracePath(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mTracePath = path;
+}
+
+std::unique_ptr<HidBackend> DevicePool::Record(std::unique_ptr<HidBackend> backend) {
+	if (mTracePath.empty()) {
+		return backend;
+	}
+
+	// the first device gets the path as given, the next ones a .N suffix by device index
+	std::string tracePath = mWorkers.empty() ? mTracePath : mTracePath + "." + std::to_string(mWorkers.size());
+	return std::unique_ptr<HidBackend>(new RecordingBackend(std::move(backend), tracePath));
+}
+
+bool DevicePool::Open() {
+	Refresh();
+
+	std::vector<std::future<bool>> results;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (std::unique_ptr<DeviceWorker>& worker : mWorkers) {
+			results.push_back(worker->Open());
+		}
+	}
+
+	bool anyReady = false;
+	for (std::future<bool>& result : results) {
+		anyReady |= result.get();
+	}
+
+	return anyReady;
+}
+
+size_t DevicePool::GetNumDevices() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mWorkers.size();
+}
+
+void DevicePool::SetDevicesChanged(DevicesChanged devicesChanged) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mDevicesChanged = devicesChanged;
+	if (mDevicesChanged) {
+		mDevicesChanged(mNumPresent);
+	}
+}
+
+void DevicePool::NotifyDevicesChanged() {
+	const size_t numPresent = (size_t)std::count(mPresent.begin(), mPresent.end(), true);
+	if (numPresent == mNumPresent) {
+		return;
+	}
+
+	mNumPresent = numPresent;
+	if (mDevicesChanged) {
+		mDevicesChanged(mNumPresent);
+	}
+}
+
+std::vector<DeviceWorker::Response> DevicePool::Broadcast(const APDU& apdu) {
+	std::vector<std::future<DeviceWorker::Response>> pending;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (std::unique_ptr<DeviceWorker>& worker : mWorkers) {
+			pending.push_back(worker->Exchange(apdu));
+		}
+	}
+
+	std::vector<DeviceWorker::Response> responses;
+	for (std::future<DeviceWorker::Response>& response : pending) {
+		responses.push_back(response.get());
+	}
+
+	return responses;
+}
+
+DeviceWorker::Response DevicePool::Exchange(const APDU& apdu) {
+	DeviceWorker* worker = Acquire(nullptr);
+	if (worker == nullptr) {
+		LOG_ERR("No device attached");
+		return {};
+	}
+
+	return worker->Exchange(apdu).get();
+}
+
+DeviceWorker::Response DevicePool::Exchange(const CommandBuilder& buildCommands, const ByteArray& keyBlob, const CancelFlag& cancel) {
+	DeviceWorker* worker = Acquire(&keyBlob);
+	if (worker == nullptr) {
+		LOG_ERR("No device attached");
+		return {};
+	}
+
+	return worker->Exchange(buildCommands(worker->GetMaxPayload()), cancel).get();
+}
+
+void DevicePool::AddAffinity(const ByteArray& keyBlob, size_t deviceIndex) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<size_t>& devices = mAffinity[keyBlob.Get()];
+	if (std::find(devices.begin(), devices.end(), deviceIndex) == devices.end()) {
+		devices.push_back(deviceIndex);
+	}
+}
+
+DeviceWorker* DevicePool::Acquire(const ByteArray* keyBlob) {
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	// keys that were never seen on a device may be on any of them
+	const std::vector<size_t>* candidates = nullptr;
+	if (keyBlob != nullptr) {
+		std::map<std::vector<uint8_t>, std::vector<size_t>>::const_iterator it = mAffinity.find(keyBlob->Get());
+		if (it != mAffinity.end() && !it->second.empty()) {
+			candidates = &it->second;
+		}
+	}
+
+	// when every device that showed the key is unplugged, it may be back under a new path
+	DeviceWorker* best = FindLeastBusy(candidates);
+	if (best == nullptr && candidates != nullptr) {
+		best = FindLeastBusy(nullptr);
+	}
+
+	return best;
+}
+
+DeviceWorker* DevicePool::FindLeastBusy(const std::vector<size_t>* candidates) {
+	// unplugged devices have no jobs but would fail every one
+	DeviceWorker* best = nullptr;
+	size_t bestLoad = 0;
+	for (size_t i = 0; i < mWorkers.size(); ++i) {
+		if (!mPresent[i] || (candidates != nullptr && std::find(candidates->begin(), candidates->end(), i) == candidates->end())) {
+			continue;
+		}
+
+		size_t load = mWorkers[i]->GetPendingJobs();
+		if (best == nullptr || load < bestLoad) {
+			best = mWorkers[i].get();
+			bestLoad = load;
+		}
+	}
+
+	return best;
+}
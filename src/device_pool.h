@@ -0,0 +1,74 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device_worker.h"
+
+// All attached Ledger devices, each with its own worker.
+// Public keys remember which devices produced them so sign requests go to a
+// device holding the key, spread over the idle ones when seeds are shared.
+class DevicePool {
+public:
+	// builds the commands of one request for a device taking maxPayload bytes per APDU
+	typedef std::function<std::vector<APDU>(size_t maxPayload)> CommandBuilder;
+	// told the number of plugged in devices when one is attached or removed
+	typedef std::function<void(size_t numDevices)> DevicesChanged;
+
+	DevicePool();
+	~DevicePool();
+
+	// picks up newly attached devices and closes removed ones
+	void Refresh();
+
+	// adds a device that is not enumerated through hidapi, such as the emulator;
+	// HID backends are recorded like enumerated devices, APDU transports never are
+	void Attach(std::unique_ptr<HidBackend> backend);
+	void Attach(std::unique_ptr<ApduTransport> transport);
+
+	// records the HID traffic of devices enumerated or attached from now on,
+	// one trace per device
+	void SetTracePath(const std::string& path);
+
+	// true when at least one device has the app ready
+	bool Open();
+
+	size_t GetNumDevices();
+
+	// replaces the listener, which is told the current count at once;
+	// called with the pool locked, so it must not call back into the pool
+	void SetDevicesChanged(DevicesChanged devicesChanged);
+
+	// sends to every device, responses are in device order
+	std::vector<DeviceWorker::Response> Broadcast(const APDU& apdu);
+
+	// sends to the least busy device
+	DeviceWorker::Response Exchange(const APDU& apdu);
+
+	// sends to the least busy device that holds keyBlob, chunked for that device
+	DeviceWorker::Response Exchange(const CommandBuilder& buildCommands, const ByteArray& keyBlob, const CancelFlag& cancel = CancelFlag());
+
+	void AddAffinity(const ByteArray& keyBlob, size_t deviceIndex);
+
+private:
+	DeviceWorker* Acquire(const ByteArray* keyBlob);
+	// among the devices at candidates, or all when null; called with mMutex held
+	DeviceWorker* FindLeastBusy(const std::vector<size_t>* candidates);
+	// wraps the backend of the next device when recording; called with mMutex held
+	std::unique_ptr<HidBackend> Record(std::unique_ptr<HidBackend> backend);
+	// tells the listener when the plugged in count moved; called with mMutex held
+	void NotifyDevicesChanged();
+
+	std::mutex mMutex;
+	std::string mTracePath;
+	std::vector<std::string> mPaths;
+	// false while the device at that index is unplugged
+	std::vector<bool> mPresent;
+	std::vector<std::unique_ptr<DeviceWorker>> mWorkers;
+	std::map<std::vector<uint8_t>, std::vector<size_t>> mAffinity;
+	DevicesChanged mDevicesChanged;
+	size_t mNumPresent = 0;
+};
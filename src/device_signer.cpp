@@ -0,0 +1,98 @@
+#include "device_signer.h"
+
+#include "apdu_status.h"
+
+// r and s of a DER encoded ECDSA signature: 0x30 len 0x02 rlen r 0x02 slen s
+static bool ParseDerSignature(const std::vector<uint8_t>& der, ByteSpan& r, ByteSpan& s) {
+	if (der.size() < 2 || der[0] != 0x30) {
+		return false;
+	}
+
+	size_t offset = 2;
+	if ((der[1] & 0x80) != 0) {
+		offset += der[1] & 0x7f;
+	}
+
+	ByteSpan* integers[2] = { &r, &s };
+	for (ByteSpan* integer : integers) {
+		if (offset + 2 > der.size() || der[offset] != 0x02 || der[offset + 1] > der.size() - offset - 2) {
+			return false;
+		}
+
+		integer->data = der.data() + offset + 2;
+		integer->size = der[offset + 1];
+		offset += 2 + integer->size;
+	}
+
+	return true;
+}
+
+DeviceSigner::DeviceSigner(DevicePool& devices)
+	: mDevices(devices) {
+}
+
+bool DeviceSigner::Sign(const Identity& ident, const ByteSpan& challenge, ByteArray& response, const CancelFlag& cancel) {
+	// the first chunk starts with the key path, chunks are as large as the device takes
+	const ByteArray dongle_path = ident.GetPathBIP32();
+	const uint8_t p2 = 0x80 | ident.keyType.GetP2();
+	DevicePool::CommandBuilder buildChunks = [&](size_t maxPayload) {
+		// no commands fail the exchange, the first chunk needs room past the path
+		std::vector<APDU> chunks;
+		if (maxPayload <= dongle_path.Size()) {
+			return chunks;
+		}
+
+		size_t offset = 0;
+		std::vector<uint8_t> chunk;
+		while (offset != challenge.size) {
+			chunk.clear();
+			if (offset == 0) {
+				chunk.insert(chunk.end(), dongle_path.Get().begin(), dongle_path.Get().end());
+			}
+
+			size_t chunk_size = challenge.size - offset;
+			if (chunk_size > maxPayload - chunk.size()) {
+				chunk_size = maxPayload - chunk.size();
+			}
+			chunk.insert(chunk.end(), challenge.data + offset, challenge.data + offset + chunk_size);
+
+			// first or next chunk, signing an ssh message with the identity curve;
+			// the last one is marked, the app only finds the end of a userauth request
+			// by itself and SSHSIG blobs are not one
+			uint8_t p1 = offset == 0 ? 0x00 : 0x01;
+			offset += chunk_size;
+			if (offset == challenge.size) {
+				p1 |= 0x80;
+			}
+
+			chunks.push_back(APDU(0x80, 0x04, p1, p2, chunk.data(), chunk.size()));
+		}
+
+		return chunks;
+	};
+
+	// all chunks go to one device holding the key
+	DeviceWorker::Response deviceResponse = mDevices.Exchange(buildChunks, ident.pubkey_cached, cancel);
+	if (!deviceResponse.valid || deviceResponse.statusCode != CODE_SUCCESS) {
+		return false;
+	}
+	const std::vector<uint8_t>& signature = deviceResponse.data.Get();
+
+	// raw 64 byte ed25519 signature, or DER encoded ECDSA r and s
+	constexpr size_t ed25519SignatureSize = 64;
+	const bool isEd25519 = ident.keyType.GetName() == "ed25519";
+	ByteSpan r;
+	ByteSpan s;
+	if (isEd25519 ? signature.size() < ed25519SignatureSize : !ParseDerSignature(signature, r, s)) {
+		return false;
+	}
+
+	// < response: string(key type, string(signature value))
+	if (isEd25519) {
+		WriteSignResponse(response, ident.keyType.GetKeyType(), signature.data(), ed25519SignatureSize);
+	}
+	else {
+		WriteEcdsaSignResponse(response, ident.keyType.GetKeyType(), r, s);
+	}
+	return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "device_pool.h"
+#include "signer.h"
+
+// Signs with the SSH/PGP app, on one of the devices holding the identity's key.
+// Each signature waits for the user to confirm it on the device.
+class DeviceSigner : public Signer {
+public:
+	explicit DeviceSigner(DevicePool& devices);
+
+	bool Sign(const Identity& ident, const ByteSpan& data, ByteArray& response, const CancelFlag& cancel) override;
+
+private:
+	DevicePool& mDevices;
+};
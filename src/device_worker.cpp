@@ -0,0 +1,253 @@
+#include "device_worker.h"
+
+#include "apdu_status.h"
+#include "hid_transport.h"
+#include "logger.h"
+#include <string>
+
+// name reported by the dashboard for GET_APP_AND_VERSION
+const std::string dashboardName = "BOLOS";
+
+DeviceWorker::DeviceWorker()
+	: mTransport(new HidTransport())
+	, mPendingJobs(0)
+	, mMaxPayload(shortPayloadMax) {
+}
+
+DeviceWorker::DeviceWorker(std::unique_ptr<HidBackend> backend)
+	: mTransport(new HidTransport(std::move(backend)))
+	, mPendingJobs(0)
+	, mMaxPayload(shortPayloadMax) {
+}
+
+DeviceWorker::DeviceWorker(std::unique_ptr<ApduTransport> transport)
+	: mTransport(std::move(transport))
+	, mPendingJobs(0)
+	, mMaxPayload(shortPayloadMax) {
+}
+
+DeviceWorker::~DeviceWorker() {
+	Stop();
+}
+
+void DeviceWorker::Start() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mRunning) {
+		return;
+	}
+
+	mRunning = true;
+	mThread = std::thread(&DeviceWorker::Run, this);
+}
+
+void DeviceWorker::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (!mRunning) {
+			return;
+		}
+		mRunning = false;
+	}
+
+	mCondition.notify_all();
+	if (mThread.joinable()) {
+		mThread.join();
+	}
+}
+
+std::future<bool> DeviceWorker::Open() {
+	// std::function needs a copyable callable
+	std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+	std::future<bool> result = promise->get_future();
+
+	Post([this, promise]() {
+		promise->set_value(Connect());
+	});
+
+	return result;
+}
+
+std::future<DeviceWorker::Response> DeviceWorker::Exchange(const APDU& apdu) {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+
+	Post([this, promise, apdu]() {
+		// nothing is sent unless the app is known to be running
+		Response response;
+		if (EnsureApp()) {
+			Transact(apdu, response);
+		}
+		promise->set_value(std::move(response));
+	});
+
+	return result;
+}
+
+std::future<DeviceWorker::Response> DeviceWorker::Exchange(const std::vector<APDU>& apdus, const CancelFlag& cancel) {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+
+	Post([this, promise, apdus, cancel]() {
+		Response response;
+		if (!EnsureApp()) {
+			promise->set_value(std::move(response));
+			return;
+		}
+
+		// the app only asks the user once the last chunk is in, so stopping between
+		// chunks spares the prompt; a first chunk starts over on the next request;
+		// every chunk is answered into the same response
+		for (const APDU& apdu : apdus) {
+			if (IsCancelled(cancel)) {
+				LOG_DBG("Exchange cancelled");
+				response.valid = false;
+				response.data.Clear();
+				break;
+			}
+
+			if (!Transact(apdu, response) || response.statusCode != CODE_SUCCESS) {
+				break;
+			}
+		}
+		promise->set_value(std::move(response));
+	});
+
+	return result;
+}
+
+size_t DeviceWorker::GetPendingJobs() const {
+	return mPendingJobs;
+}
+
+size_t DeviceWorker::GetMaxPayload() const {
+	return mMaxPayload;
+}
+
+void DeviceWorker::OnDeviceArrival() {
+	// warm up the session so the first request does not pay for it
+	Post([this]() {
+		Connect();
+	});
+}
+
+void DeviceWorker::OnDeviceRemoval() {
+	Post([this]() {
+		mTransport->Close();
+	});
+}
+
+void DeviceWorker::Post(std::function<void()> job) {
+	Start();
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJobs.push_back(std::move(job));
+		mPendingJobs++;
+	}
+	mCondition.notify_one();
+}
+
+void DeviceWorker::Run() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCondition.wait(lock, [this]() { return !mRunning || !mJobs.empty(); });
+
+			// finish queued work before leaving so no future is left unset
+			if (mJobs.empty()) {
+				return;
+			}
+
+			job = std::move(mJobs.front());
+			mJobs.pop_front();
+		}
+
+		job();
+		mPendingJobs--;
+	}
+}
+
+bool DeviceWorker::Connect() {
+	if (!mTransport->Open()) {
+		return false;
+	}
+
+	// a ready app stays cached until the device is closed
+	if (!mTransport->IsAppReady()) {
+		mTransport->SetAppReady(ProbeApp());
+		mMaxPayload = mTransport->IsAppReady() ? ClampPayload(mTransport->GetMaxPayload()) : shortPayloadMax;
+	}
+
+	return mTransport->IsAppReady();
+}
+
+bool DeviceWorker::EnsureApp() {
+	// opens after a removal, probes again after another app answered
+	if (mTransport->IsOpen() && mTransport->IsAppReady()) {
+		return true;
+	}
+
+	if (!Connect()) {
+		LOG_ERR("SSH/PGP app not available, request not sent");
+		return false;
+	}
+
+	return true;
+}
+
+bool DeviceWorker::ProbeApp() {
+	// GET_APP_AND_VERSION, answered by the dashboard and by every app
+	APDU probe(0xB0, 0x01, 0x00, 0x00, ByteArray());
+	Response response;
+	if (!Transact(probe, response)) {
+		return false;
+	}
+
+	if (response.statusCode == CODE_INS_NOT_SUPPORTED || response.statusCode == CODE_CLA_NOT_SUPPORTED) {
+		// older firmware does not know the probe, let the first exchange decide
+		return true;
+	}
+
+	// format(1) name length(1) name ...
+	if (response.data.Size() < 2 || response.data.Size() < 2u + response.data[1]) {
+		return false;
+	}
+
+	std::string appName((const char*)response.data.Get().data() + 2, response.data[1]);
+	if (appName == dashboardName) {
+		LOG_WARN("No application opened on device");
+		return false;
+	}
+
+	return true;
+}
+
+size_t DeviceWorker::ClampPayload(size_t maxPayload) {
+	// every app takes short APDUs, and a chunk must have room past the key path
+	if (maxPayload < shortPayloadMax) {
+		return shortPayloadMax;
+	}
+
+	return maxPayload > extendedPayloadMax ? extendedPayloadMax : maxPayload;
+}
+
+bool DeviceWorker::Transact(const APDU& apdu, Response& outResponse) {
+	if (!apdu.IsValid()) {
+		LOG_ERR("APDU payload too long");
+		outResponse.valid = false;
+		outResponse.data.Clear();
+		return false;
+	}
+
+	if (!mTransport->Exchange(apdu, outResponse)) {
+		return false;
+	}
+
+	// another app took over, probe again on the next open
+	if (outResponse.statusCode == CODE_INS_NOT_SUPPORTED || outResponse.statusCode == CODE_CLA_NOT_SUPPORTED) {
+		mTransport->SetAppReady(false);
+	}
+
+	return true;
+}
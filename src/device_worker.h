@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "apdu.h"
+#include "apdu_transport.h"
+#include "cancel_flag.h"
+#include "ledger_device.h"
+
+// Owns the Ledger device on a dedicated thread.
+// Callers queue work and wait on the returned future instead of polling the
+// device themselves; reads on the worker block until data or timeout.
+// The handle stays open between requests and is reopened on plug events,
+// whether the SSH/PGP app is running is probed once per connection.
+class DeviceWorker {
+public:
+	typedef ApduResponse Response;
+
+	DeviceWorker();
+	explicit DeviceWorker(std::unique_ptr<HidBackend> backend);
+	explicit DeviceWorker(std::unique_ptr<ApduTransport> transport);
+	~DeviceWorker();
+
+	void Start();
+	void Stop();
+
+	std::future<bool> Open();
+	std::future<Response> Exchange(const APDU& apdu);
+
+	// runs the commands back to back without other jobs in between,
+	// stops at the first failing status and returns its response;
+	// once cancel is set no further command is sent and the response is invalid
+	std::future<Response> Exchange(const std::vector<APDU>& apdus, const CancelFlag& cancel = CancelFlag());
+
+	// queued and running jobs
+	size_t GetPendingJobs() const;
+
+	// largest command payload the running app accepts, as the transport reports it
+	size_t GetMaxPayload() const;
+
+	// hotplug notifications
+	void OnDeviceArrival();
+	void OnDeviceRemoval();
+
+private:
+	void Post(std::function<void()> job);
+	void Run();
+	bool Connect();
+	// connects unless open with the app known ready
+	bool EnsureApp();
+	bool ProbeApp();
+	static size_t ClampPayload(size_t maxPayload);
+	// answers into outResponse, reusing its buffer; false when no response came back
+	bool Transact(const APDU& apdu, Response& outResponse);
+
+	std::unique_ptr<ApduTransport> mTransport;
+
+	std::thread mThread;
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<std::function<void()>> mJobs;
+	std::atomic<size_t> mPendingJobs;
+	std::atomic<size_t> mMaxPayload;
+	bool mRunning = false;
+};
@@ -0,0 +1,114 @@
+#include "ecdh_cache.h"
+
+#include <iterator>
+
+// overwritten through a volatile pointer so the stores are not left out
+static void Wipe(std::vector<uint8_t>& secret) {
+	volatile uint8_t* data = secret.data();
+	for (size_t i = 0; i < secret.size(); ++i) {
+		data[i] = 0;
+	}
+}
+
+EcdhCache::EcdhCache(size_t maxEntries, std::chrono::milliseconds timeToLive)
+	: mMaxEntries(maxEntries)
+	, mTimeToLive(timeToLive) {
+}
+
+EcdhCache::~EcdhCache() {
+	Clear();
+}
+
+void EcdhCache::SetLimits(size_t maxEntries, std::chrono::milliseconds timeToLive) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMaxEntries = timeToLive.count() > 0 ? maxEntries : 0;
+	mTimeToLive = timeToLive;
+	while (mEntries.size() > mMaxEntries) {
+		Erase(std::prev(mEntries.end()));
+		mStats.evicted++;
+	}
+}
+
+bool EcdhCache::Find(const std::string& key, std::vector<uint8_t>& outSecret) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = mIndex.find(key);
+	if (it == mIndex.end()) {
+		return false;
+	}
+
+	std::list<Entry>::iterator entry = it->second;
+	if (entry->expiresAt <= std::chrono::steady_clock::now()) {
+		Erase(entry);
+		mStats.expired++;
+		return false;
+	}
+
+	// the time to live runs from when the device was asked, not from the last use
+	mEntries.splice(mEntries.begin(), mEntries, entry);
+	outSecret = entry->secret;
+	mStats.hits++;
+	return true;
+}
+
+void EcdhCache::Insert(const std::string& key, const std::vector<uint8_t>& secret) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mMaxEntries == 0) {
+		return;
+	}
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	std::unordered_map<std::string, std::list<Entry>::iterator>::iterator it = mIndex.find(key);
+	if (it != mIndex.end()) {
+		Erase(it->second);
+	}
+
+	// expired entries make room before any is evicted
+	if (mEntries.size() >= mMaxEntries) {
+		RemoveExpired(now);
+	}
+	while (mEntries.size() >= mMaxEntries) {
+		Erase(std::prev(mEntries.end()));
+		mStats.evicted++;
+	}
+
+	Entry entry;
+	entry.key = key;
+	entry.secret = secret;
+	entry.expiresAt = now + mTimeToLive;
+	mEntries.push_front(std::move(entry));
+	mIndex[key] = mEntries.begin();
+	mStats.stored++;
+}
+
+void EcdhCache::Clear() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	while (!mEntries.empty()) {
+		Erase(mEntries.begin());
+	}
+}
+
+EcdhCache::Stats EcdhCache::GetStats() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	Stats stats = mStats;
+	stats.entries = mEntries.size();
+	return stats;
+}
+
+void EcdhCache::Erase(std::list<Entry>::iterator entry) {
+	Wipe(entry->secret);
+	mIndex.erase(entry->key);
+	mEntries.erase(entry);
+}
+
+void EcdhCache::RemoveExpired(std::chrono::steady_clock::time_point now) {
+	// entries are not ordered by expiry once used, all are looked at
+	std::list<Entry>::iterator entry = mEntries.begin();
+	while (entry != mEntries.end()) {
+		std::list<Entry>::iterator next = std::next(entry);
+		if (entry->expiresAt <= now) {
+			Erase(entry);
+			mStats.expired++;
+		}
+		entry = next;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared secrets the device derived, by identity and peer public key, so an
+// ECDH with the same peer key again needs no confirmation on the device.
+// Entries expire after their time to live; when full, the least recently
+// used goes first. Secrets are wiped when dropped.
+class EcdhCache {
+public:
+	struct Stats {
+		size_t entries = 0;
+		uint64_t hits = 0;
+		uint64_t stored = 0;
+		uint64_t expired = 0;
+		uint64_t evicted = 0;
+	};
+
+	EcdhCache(size_t maxEntries = 256, std::chrono::milliseconds timeToLive = std::chrono::minutes(10));
+	~EcdhCache();
+
+	// zero entries or time to live turns caching off and drops what is kept
+	void SetLimits(size_t maxEntries, std::chrono::milliseconds timeToLive);
+
+	bool Find(const std::string& key, std::vector<uint8_t>& outSecret);
+	void Insert(const std::string& key, const std::vector<uint8_t>& secret);
+	void Clear();
+
+	Stats GetStats();
+
+private:
+	struct Entry {
+		std::string key;
+		std::vector<uint8_t> secret;
+		std::chrono::steady_clock::time_point expiresAt;
+	};
+
+	void Erase(std::list<Entry>::iterator entry);
+	void RemoveExpired(std::chrono::steady_clock::time_point now);
+
+	std::mutex mMutex;
+	// most recently used first
+	std::list<Entry> mEntries;
+	std::unordered_map<std::string, std::list<Entry>::iterator> mIndex;
+	size_t mMaxEntries;
+	std::chrono::milliseconds mTimeToLive;
+	Stats mStats;
+};
@@ -0,0 +1,519 @@
+#include "emulated_device.h"
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/dsa.h>
+#include <cryptopp/eccrypto.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/integer.h>
+#include <cryptopp/nbtheory.h>
+#include <cryptopp/oids.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/xed25519.h>
+
+#include "apdu_status.h"
+#include "logger.h"
+
+constexpr uint8_t CLA_APP = 0x80;
+constexpr uint8_t CLA_DASHBOARD = 0xB0;
+constexpr uint8_t INS_GET_APP_AND_VERSION = 0x01;
+constexpr uint8_t INS_GET_PUBLIC_KEY = 0x02;
+constexpr uint8_t INS_SIGN = 0x04;
+constexpr uint8_t INS_ECDH = 0x0A;
+
+constexpr uint8_t P1_NEXT = 0x01;
+constexpr uint8_t P1_LAST = 0x80;
+constexpr uint8_t P2_SSH = 0x80;
+constexpr uint8_t CURVE_NIST256P1 = 0x01;
+constexpr uint8_t CURVE_ED25519 = 0x02;
+
+constexpr uint32_t hardened_mask = 0x80000000;
+
+const std::string appName = "SSH/PGP Agent";
+const std::string appVersion = "0.0.7";
+
+static std::vector<uint8_t> HmacSha512(const uint8_t* key, size_t keyLength, const std::vector<uint8_t>& data) {
+	CryptoPP::HMAC<CryptoPP::SHA512> hmac(key, keyLength);
+	std::vector<uint8_t> digest(CryptoPP::SHA512::DIGESTSIZE);
+	hmac.CalculateDigest(digest.data(), data.data(), data.size());
+	return digest;
+}
+
+static void AppendInteger(std::vector<uint8_t>& out, const CryptoPP::Integer& value) {
+	uint8_t bytes[32];
+	value.Encode(bytes, sizeof(bytes));
+	out.insert(out.end(), bytes, bytes + sizeof(bytes));
+}
+
+// the device reports ed25519 keys as an uncompressed point, x has to be recovered from y
+static void DecompressEd25519(const uint8_t* compressed, CryptoPP::Integer& x, CryptoPP::Integer& y) {
+	uint8_t bigEndian[32];
+	for (size_t i = 0; i < 32; ++i) {
+		bigEndian[i] = compressed[31 - i];
+	}
+
+	const bool xIsOdd = (bigEndian[0] & 0x80) != 0;
+	bigEndian[0] &= 0x7f;
+	y = CryptoPP::Integer(bigEndian, sizeof(bigEndian));
+
+	// x^2 = (y^2 - 1) / (d y^2 + 1), d = -121665 / 121666
+	const CryptoPP::Integer p = CryptoPP::Integer::Power2(255) - 19;
+	const CryptoPP::Integer d = (p - 121665) * CryptoPP::Integer(121666).InverseMod(p) % p;
+	const CryptoPP::Integer y2 = y * y % p;
+	const CryptoPP::Integer u = (y2 + p - 1) % p;
+	const CryptoPP::Integer v = (d * y2 + 1) % p;
+
+	const CryptoPP::Integer v3 = v * v % p * v % p;
+	const CryptoPP::Integer v7 = v3 * v3 % p * v % p;
+	x = u * v3 % p * CryptoPP::a_exp_b_mod_c(u * v7 % p, (p - 5) / 8, p) % p;
+
+	if (v * x % p * x % p != u) {
+		x = x * CryptoPP::a_exp_b_mod_c(2, (p - 1) / 4, p) % p;
+	}
+
+	if (x.IsOdd() != xIsOdd) {
+		x = p - x;
+	}
+}
+
+static bool SkipSshString(const std::vector<uint8_t>& message, size_t& offset) {
+	if (message.size() < offset + 4) {
+		return false;
+	}
+
+	uint32_t length = (uint32_t)message[offset] << 24u | (uint32_t)message[offset + 1] << 16u |
+		(uint32_t)message[offset + 2] << 8u | (uint32_t)message[offset + 3];
+	offset += 4;
+
+	if (length > message.size() - offset) {
+		return false;
+	}
+
+	offset += length;
+	return true;
+}
+
+// hosts that do not mark the last chunk rely on the app parsing the userauth request:
+// session id, request type, user, service, method, has signature, algorithm, key
+static bool IsCompleteSshMessage(const std::vector<uint8_t>& message) {
+	size_t offset = 0;
+	if (!SkipSshString(message, offset) || message.size() < offset + 1) {
+		return false;
+	}
+	offset += 1;
+
+	if (!SkipSshString(message, offset) || !SkipSshString(message, offset) || !SkipSshString(message, offset)) {
+		return false;
+	}
+
+	if (message.size() < offset + 1) {
+		return false;
+	}
+	offset += 1;
+
+	return SkipSshString(message, offset) && SkipSshString(message, offset);
+}
+
+EmulatedDevice::EmulatedDevice(const EmulatorConfig& config)
+	: mConfig(config)
+	, mRandom(config.randomSeed) {
+}
+
+EmulatedDevice::~EmulatedDevice() {
+}
+
+bool EmulatedDevice::Open() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOpen = true;
+	mReports.clear();
+	mCommand.Reset();
+	return true;
+}
+
+void EmulatedDevice::Close() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mOpen = false;
+	mReports.clear();
+}
+
+bool EmulatedDevice::IsOpen() const {
+	return mOpen;
+}
+
+int EmulatedDevice::Read(uint8_t* data, size_t length, int timeoutMs) {
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+	while (true) {
+		if (!mOpen) {
+			return -1;
+		}
+
+		const Clock::time_point now = Clock::now();
+		if (!mReports.empty() && mReports.front().readyAt <= now) {
+			break;
+		}
+
+		// negative timeout blocks like hid_read
+		if (timeoutMs >= 0 && now >= deadline) {
+			return 0;
+		}
+
+		if (!mReports.empty()) {
+			Clock::time_point wakeAt = mReports.front().readyAt;
+			if (timeoutMs >= 0 && deadline < wakeAt) {
+				wakeAt = deadline;
+			}
+			mCondition.wait_until(lock, wakeAt);
+		}
+		else if (timeoutMs >= 0) {
+			mCondition.wait_until(lock, deadline);
+		}
+		else {
+			mCondition.wait(lock);
+		}
+	}
+
+	if (Chance(mConfig.disconnectRate)) {
+		mOpen = false;
+		return -1;
+	}
+
+	size_t readLength = length < packet_size ? length : packet_size;
+	memcpy(data, mReports.front().data, readLength);
+	mReports.pop_front();
+	return (int)readLength;
+}
+
+int EmulatedDevice::Write(const uint8_t* data, size_t length) {
+	if (!mOpen || Chance(mConfig.disconnectRate)) {
+		mOpen = false;
+		return -1;
+	}
+
+	// skip the report id
+	if (length < 1 + frameHeaderSize) {
+		return -1;
+	}
+	const uint8_t* frame = data + 1;
+
+	// sequence 0 always starts a new command
+	if (frame[3] == 0 && frame[4] == 0) {
+		mCommand.Reset();
+	}
+
+	ApduReassembler::State state = mCommand.Feed(frame, length - 1);
+	if (state == ApduReassembler::State::Complete) {
+		HandleCommand(mCommand.Data(), mCommand.MessageSize());
+	}
+	else if (state == ApduReassembler::State::Error) {
+		LOG_WARN("Emulator received an invalid frame");
+		mCommand.Reset();
+	}
+
+	return (int)length;
+}
+
+size_t EmulatedDevice::GetMaxPayload() const {
+	return mConfig.maxPayload;
+}
+
+void EmulatedDevice::HandleCommand(const uint8_t* command, size_t length) {
+	if (length < 5) {
+		Respond({}, CODE_WRONG_LENGTH, false);
+		return;
+	}
+
+	const uint8_t cla = command[0];
+	const uint8_t ins = command[1];
+	const uint8_t p1 = command[2];
+	const uint8_t p2 = command[3];
+	const uint8_t* data = command + 5;
+	size_t dataLength = length - 5;
+
+	// extended length: 0x00 then two length bytes
+	if (command[4] == 0x00 && length > 7) {
+		if (mConfig.maxPayload <= shortPayloadMax) {
+			Respond({}, CODE_WRONG_LENGTH, false);
+			return;
+		}
+
+		data = command + 7;
+		dataLength = length - 7;
+	}
+
+	if (dataLength > mConfig.maxPayload) {
+		Respond({}, CODE_WRONG_LENGTH, false);
+		return;
+	}
+
+	if (cla == CLA_DASHBOARD && ins == INS_GET_APP_AND_VERSION) {
+		// format, name, version, flags
+		std::vector<uint8_t> response;
+		response.push_back(0x01);
+		response.push_back((uint8_t)appName.size());
+		response.insert(response.end(), appName.begin(), appName.end());
+		response.push_back((uint8_t)appVersion.size());
+		response.insert(response.end(), appVersion.begin(), appVersion.end());
+		response.push_back(0x01);
+		response.push_back(0x00);
+		Respond(response, CODE_SUCCESS, false);
+		return;
+	}
+
+	if (cla != CLA_APP) {
+		Respond({}, CODE_CLA_NOT_SUPPORTED, false);
+		return;
+	}
+
+	switch (ins) {
+	case INS_GET_PUBLIC_KEY:
+		HandleGetPublicKey(p2, data, dataLength);
+		break;
+	case INS_SIGN:
+		HandleSign(p1, p2, data, dataLength);
+		break;
+	case INS_ECDH:
+		HandleEcdh(p2, data, dataLength);
+		break;
+	default:
+		Respond({}, CODE_INS_NOT_SUPPORTED, false);
+		break;
+	}
+}
+
+void EmulatedDevice::HandleGetPublicKey(uint8_t p2, const uint8_t* data, size_t length) {
+	const uint8_t curve = (uint8_t)(p2 & ~P2_SSH);
+
+	std::vector<uint8_t> privateKey;
+	size_t pathSize = 0;
+	if (!DerivePrivateKey(curve, data, length, privateKey, pathSize)) {
+		Respond({}, CODE_INVALID_DATA, false);
+		return;
+	}
+
+	// length, uncompressed point marker, x, y
+	std::vector<uint8_t> response;
+	response.push_back(65);
+	response.push_back(0x04);
+
+	if (curve == CURVE_NIST256P1) {
+		CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA256>::PrivateKey key;
+		key.Initialize(CryptoPP::ASN1::secp256r1(), CryptoPP::Integer(privateKey.data(), privateKey.size()));
+
+		CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA256>::PublicKey publicKey;
+		key.MakePublicKey(publicKey);
+
+		const CryptoPP::ECP::Point& point = publicKey.GetPublicElement();
+		AppendInteger(response, point.x);
+		AppendInteger(response, point.y);
+	}
+	else {
+		CryptoPP::ed25519::Signer signer(privateKey.data());
+		const CryptoPP::ed25519PrivateKey& key = dynamic_cast<const CryptoPP::ed25519PrivateKey&>(signer.GetPrivateKey());
+
+		CryptoPP::Integer x;
+		CryptoPP::Integer y;
+		DecompressEd25519(key.GetPublicKeyBytePtr(), x, y);
+		AppendInteger(response, x);
+		AppendInteger(response, y);
+	}
+
+	Respond(response, CODE_SUCCESS, true);
+}
+
+void EmulatedDevice::HandleSign(uint8_t p1, uint8_t p2, const uint8_t* data, size_t length) {
+	size_t offset = 0;
+	if ((p1 & P1_NEXT) == 0) {
+		// first chunk starts with the derivation path
+		mSignMessage.clear();
+		mSignCurve = (uint8_t)(p2 & ~P2_SSH);
+		if (!DerivePrivateKey(mSignCurve, data, length, mSignKey, offset)) {
+			mSignKey.clear();
+			Respond({}, CODE_INVALID_DATA, false);
+			return;
+		}
+	}
+	else if (mSignKey.empty()) {
+		Respond({}, CODE_INVALID_DATA, false);
+		return;
+	}
+
+	mSignMessage.insert(mSignMessage.end(), data + offset, data + length);
+
+	const bool isLast = (p1 & P1_LAST) != 0 || ((p2 & P2_SSH) != 0 && IsCompleteSshMessage(mSignMessage));
+	if (!isLast) {
+		Respond({}, CODE_SUCCESS, false);
+		return;
+	}
+
+	std::vector<uint8_t> signature;
+	if (mSignCurve == CURVE_NIST256P1) {
+		CryptoPP::AutoSeededRandomPool rng;
+		CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA256>::Signer signer;
+		signer.AccessKey().Initialize(CryptoPP::ASN1::secp256r1(), CryptoPP::Integer(mSignKey.data(), mSignKey.size()));
+
+		std::vector<uint8_t> rawSignature(signer.MaxSignatureLength());
+		size_t rawLength = signer.SignMessage(rng, mSignMessage.data(), mSignMessage.size(), rawSignature.data());
+
+		// the app answers with a DER encoded signature
+		signature.resize(rawLength + 8);
+		size_t derLength = CryptoPP::DSAConvertSignatureFormat(signature.data(), signature.size(), CryptoPP::DSA_DER,
+			rawSignature.data(), rawLength, CryptoPP::DSA_P1363);
+		signature.resize(derLength);
+	}
+	else {
+		CryptoPP::ed25519::Signer signer(mSignKey.data());
+		signature.resize(signer.MaxSignatureLength());
+		size_t signatureLength = signer.SignMessage(CryptoPP::NullRNG(), mSignMessage.data(), mSignMessage.size(), signature.data());
+		signature.resize(signatureLength);
+	}
+
+	mSignKey.clear();
+	mSignMessage.clear();
+	Respond(signature, CODE_SUCCESS, true);
+}
+
+void EmulatedDevice::HandleEcdh(uint8_t p2, const uint8_t* data, size_t length) {
+	// path, then the peer key as an uncompressed point
+	constexpr size_t peerKeySize = 65;
+	const uint8_t curve = (uint8_t)(p2 & ~P2_SSH);
+
+	std::vector<uint8_t> privateKey;
+	size_t pathSize = 0;
+	if (curve != CURVE_NIST256P1 || !DerivePrivateKey(curve, data, length, privateKey, pathSize) ||
+		length - pathSize != peerKeySize || data[pathSize] != 0x04) {
+		Respond({}, CODE_INVALID_DATA, false);
+		return;
+	}
+
+	const CryptoPP::DL_GroupParameters_EC<CryptoPP::ECP> group(CryptoPP::ASN1::secp256r1());
+	const uint8_t* peerKey = data + pathSize + 1;
+	const CryptoPP::ECP::Point peerPoint(CryptoPP::Integer(peerKey, 32), CryptoPP::Integer(peerKey + 32, 32));
+	if (!group.GetCurve().VerifyPoint(peerPoint) || peerPoint.identity) {
+		Respond({}, CODE_INVALID_DATA, false);
+		return;
+	}
+
+	// the shared point, uncompressed
+	const CryptoPP::ECP::Point shared = group.GetCurve().ScalarMultiply(peerPoint, CryptoPP::Integer(privateKey.data(), privateKey.size()));
+	std::vector<uint8_t> response;
+	response.push_back(0x04);
+	AppendInteger(response, shared.x);
+	AppendInteger(response, shared.y);
+
+	Respond(response, CODE_SUCCESS, true);
+}
+
+void EmulatedDevice::Respond(const std::vector<uint8_t>& data, uint16_t statusCode, bool needsApproval) {
+	Clock::time_point readyAt = Clock::now();
+	if (needsApproval) {
+		readyAt += std::chrono::milliseconds(mConfig.approvalDelayMs);
+	}
+
+	std::vector<uint8_t> message = data;
+	if (needsApproval && Chance(mConfig.rejectRate)) {
+		message.clear();
+		statusCode = CODE_USER_REJECTED;
+	}
+	message.push_back((uint8_t)(statusCode >> 8u));
+	message.push_back((uint8_t)statusCode);
+
+	if (Chance(mConfig.dropRate)) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mFramer.Begin(message.data(), message.size());
+	while (mFramer.Next()) {
+		Report report;
+		report.readyAt = readyAt;
+		// strip the report id added for hid_write
+		memcpy(report.data, mFramer.Report() + 1, packet_size);
+		mReports.push_back(report);
+
+		readyAt += std::chrono::milliseconds(mConfig.frameLatencyMs);
+	}
+	mCondition.notify_all();
+}
+
+// SLIP-10 derivation along a hardened path, as done by the device
+bool EmulatedDevice::DerivePrivateKey(uint8_t curve, const uint8_t* path, size_t length, std::vector<uint8_t>& outKey, size_t& outPathSize) {
+	if (curve != CURVE_NIST256P1 && curve != CURVE_ED25519) {
+		return false;
+	}
+
+	if (length < 1 || length < 1 + 4u * path[0]) {
+		return false;
+	}
+	const size_t numInts = path[0];
+	outPathSize = 1 + 4 * numInts;
+
+	const std::string curveSeed = curve == CURVE_ED25519 ? "ed25519 seed" : "Nist256p1 seed";
+	const CryptoPP::Integer order = CryptoPP::DL_GroupParameters_EC<CryptoPP::ECP>(CryptoPP::ASN1::secp256r1()).GetSubgroupOrder();
+
+	std::vector<uint8_t> seed(mConfig.seed.begin(), mConfig.seed.end());
+	std::vector<uint8_t> digest = HmacSha512((const uint8_t*)curveSeed.data(), curveSeed.size(), seed);
+	while (curve == CURVE_NIST256P1) {
+		CryptoPP::Integer masterKey(digest.data(), 32);
+		if (!masterKey.IsZero() && masterKey < order) {
+			break;
+		}
+		digest = HmacSha512((const uint8_t*)curveSeed.data(), curveSeed.size(), digest);
+	}
+
+	std::vector<uint8_t> key(digest.begin(), digest.begin() + 32);
+	std::vector<uint8_t> chainCode(digest.begin() + 32, digest.end());
+
+	for (size_t i = 0; i < numInts; ++i) {
+		const uint8_t* indexBytes = path + 1 + 4 * i;
+		const uint32_t index = (uint32_t)indexBytes[0] << 24u | (uint32_t)indexBytes[1] << 16u |
+			(uint32_t)indexBytes[2] << 8u | (uint32_t)indexBytes[3];
+
+		// identities only use hardened indices
+		if ((index & hardened_mask) == 0) {
+			return false;
+		}
+
+		std::vector<uint8_t> data;
+		data.push_back(0x00);
+		data.insert(data.end(), key.begin(), key.end());
+		data.insert(data.end(), indexBytes, indexBytes + 4);
+
+		while (true) {
+			digest = HmacSha512(chainCode.data(), chainCode.size(), data);
+			if (curve == CURVE_ED25519) {
+				key.assign(digest.begin(), digest.begin() + 32);
+				break;
+			}
+
+			CryptoPP::Integer tweak(digest.data(), 32);
+			CryptoPP::Integer childKey = (tweak + CryptoPP::Integer(key.data(), key.size())) % order;
+			if (tweak < order && !childKey.IsZero()) {
+				key.clear();
+				AppendInteger(key, childKey);
+				break;
+			}
+
+			// invalid key, retry with the right half
+			data.clear();
+			data.push_back(0x01);
+			data.insert(data.end(), digest.begin() + 32, digest.end());
+			data.insert(data.end(), indexBytes, indexBytes + 4);
+		}
+
+		chainCode.assign(digest.begin() + 32, digest.end());
+	}
+
+	outKey = key;
+	return true;
+}
+
+bool EmulatedDevice::Chance(double rate) {
+	if (rate <= 0.0) {
+		return false;
+	}
+
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	return distribution(mRandom) < rate;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "hid_backend.h"
+#include "hid_framing.h"
+
+struct EmulatorConfig {
+	// keys are derived from this seed the same way the device derives them
+	std::string seed = "ledger pageant test seed";
+
+	// largest command payload accepted, above 0xFF the emulator takes extended APDUs
+	// and tells the host through GetMaxPayload
+	size_t maxPayload = extendedPayloadMax;
+
+	// time the emulated user takes to confirm a public key or signature
+	int approvalDelayMs = 0;
+
+	// delay between consecutive response reports
+	int frameLatencyMs = 0;
+
+	// chance per confirmation that the user rejects it (0x6985)
+	double rejectRate = 0.0;
+
+	// chance per command that no response is sent at all
+	double dropRate = 0.0;
+
+	// chance per report that the transport fails as if unplugged
+	double disconnectRate = 0.0;
+
+	uint32_t randomSeed = 1;
+};
+
+// Software stand-in for a Ledger running the SSH/PGP app.
+// Decodes the HID framing and answers GET_APP_AND_VERSION, INS 0x02 (public
+// key), INS 0x04 (sign) and INS 0x0A (ECDH, NIST P-256 only) with keys
+// derived via SLIP-10 from a test seed.
+class EmulatedDevice : public HidBackend {
+public:
+	explicit EmulatedDevice(const EmulatorConfig& config = EmulatorConfig());
+	~EmulatedDevice();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override;
+	int Write(const uint8_t* data, size_t length) override;
+	size_t GetMaxPayload() const override;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Report {
+		Clock::time_point readyAt;
+		uint8_t data[packet_size];
+	};
+
+	void HandleCommand(const uint8_t* command, size_t length);
+	void HandleGetPublicKey(uint8_t p2, const uint8_t* data, size_t length);
+	void HandleSign(uint8_t p1, uint8_t p2, const uint8_t* data, size_t length);
+	void HandleEcdh(uint8_t p2, const uint8_t* data, size_t length);
+	void Respond(const std::vector<uint8_t>& data, uint16_t statusCode, bool needsApproval);
+
+	bool DerivePrivateKey(uint8_t curve, const uint8_t* path, size_t length, std::vector<uint8_t>& outKey, size_t& outPathSize);
+	bool Chance(double rate);
+
+	EmulatorConfig mConfig;
+	bool mOpen = false;
+	std::mt19937 mRandom;
+
+	ApduReassembler mCommand;
+	ApduFramer mFramer;
+
+	// sign message spread over several chunks
+	std::vector<uint8_t> mSignKey;
+	uint8_t mSignCurve = 0;
+	std::vector<uint8_t> mSignMessage;
+
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::deque<Report> mReports;
+};
@@ -6,6 +6,8 @@
 #include <cryptopp/oids.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/base64.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/sha.h>
 
 #include <cryptopp/xed25519.h>
 //#include <cryptopp/donna.h>
@@ -25,6 +27,21 @@ namespace encodeUtils {
 		return digest;
 	}
 
+	static std::string makeHmacSha1(const std::string& key, const std::string& msg) {
+		std::string mac;
+		CryptoPP::HMAC<CryptoPP::SHA1> hmac((const CryptoPP::byte*)key.data(), key.size());
+		CryptoPP::StringSource ss(msg, true /*pumpAll*/, new CryptoPP::HashFilter(hmac, new CryptoPP::StringSink(mac)));
+
+		return mac;
+	}
+
+	static std::string decodeBase64(const std::string& encoded) {
+		std::string decoded;
+		CryptoPP::StringSource ss(encoded, true /*pumpAll*/, new CryptoPP::Base64Decoder(new CryptoPP::StringSink(decoded)));
+
+		return decoded;
+	}
+
 	static std::string encodeBase64(const std::string& raw_string) {
 		CryptoPP::Base64Encoder encoder(nullptr, false, 1);
 		encoder.Put((const CryptoPP::byte*)raw_string.c_str(), raw_string.size());
@@ -0,0 +1,541 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <csignal>
+#endif
+
+#include "agent_core.h"
+#include "agent_socket_server.h"
+#include "device_pool.h"
+#include "emulated_device.h"
+#include "hid_trace.h"
+#include "speculos_transport.h"
+#include "sshsig.h"
+#include "stringUtil.h"
+
+// Drives AgentCore without a window: framed agent requests are read from
+// stdin and the framed responses written to stdout, or served on a Unix
+// socket usable as SSH_AUTH_SOCK with --listen.
+//
+//  pageant-headless [--emulator] [--speculos[=host[:port]]] [--replay=file[,fast]]
+//                   [--record=file] [--repeat=n] [--listen=path]
+//                   [--max-queue=n] [--max-per-client=n] [--sign-timeout=s]
+//                   [--known-hosts=file]
+//                   [--tenant=name=n,socket=path[,identity=ssh://user@host]...
+//                             [,max-queue=n][,max-connections=n][,uid=n]] ...
+//                   [--sshsig=namespace file ...]
+//                   [--ecdh-cache=entries[,ttl-seconds]]
+//                   --identity=ssh://user@host[,curve] ...
+//
+// hidapi devices are always enumerated, the other options add devices.
+// --record writes the HID traffic of each device to file, file.1 and so on,
+// the emulator and replays included; Speculos has no HID traffic to record.
+// A --replay whose session strays from the trace fails the run, the number
+// of mismatched reports is reported on stderr.
+// With --repeat the requests from stdin are run n times and the time per
+// request is reported on stderr.
+// --max-queue and --max-per-client bound the sign requests waiting for a
+// device, --sign-timeout drops those waiting longer (0 never does); the
+// counters of the device queue and of the queue of keys added by clients
+// are reported on stderr when done.
+// Clients bound with session-bind@openssh.com are offered the identities
+// whose host has their host key in --known-hosts, ~/.ssh/known_hosts by default.
+// Each --tenant adds a socket (path, or @name in the abstract namespace) whose
+// clients share one sign queue and only get the listed identities, all when
+// none is listed; served with or without --listen. An abstract socket only
+// takes clients of the agent's user unless uid= names another.
+// --sshsig signs the files given with the first identity, as ssh-keygen -Y sign
+// does, into file.sig; "-" signs stdin to stdout. Files are hashed here, the
+// next one while the device waits for the current signature.
+// --ecdh-cache bounds the shared secrets kept for ecdh@ledger.com, 0 keeps none.
+
+class IdentityList : public IdentityStore {
+public:
+	size_t GetNumIdentities() const override {
+		return mIdentities.size();
+	}
+
+	const Identity& GetIdentityByIndex(size_t index) const override {
+		return mIdentities[index];
+	}
+
+	uint64_t GetGeneration() const override {
+		return mIdentities.size();
+	}
+
+	// only grows while keys are loaded at startup
+	std::vector<Identity> mIdentities;
+};
+
+#ifdef __linux__
+static AgentSocketServer* gServer = nullptr;
+
+static void OnTerminate(int) {
+	if (gServer != nullptr) {
+		gServer->Stop();
+	}
+}
+#endif
+
+// finds --name or --name=value, value is empty when not given
+static bool MatchOption(const std::string& argument, const std::string& name, std::string& outValue) {
+	if (argument.compare(0, name.size(), name) != 0) {
+		return false;
+	}
+
+	if (argument.size() == name.size()) {
+		outValue.clear();
+		return true;
+	}
+
+	if (argument[name.size()] != '=') {
+		return false;
+	}
+
+	outValue = argument.substr(name.size() + 1);
+	return true;
+}
+
+// whole non-negative decimal number that fits T; no sign, space or suffix
+template <typename T>
+static bool ParseNumber(const std::string& value, T& outNumber) {
+	if (value.empty() || value[0] < '0' || value[0] > '9') {
+		return false;
+	}
+
+	errno = 0;
+	char* end = nullptr;
+	const unsigned long long number = strtoull(value.c_str(), &end, 10);
+	if (errno != 0 || *end != '\0' || number > (unsigned long long)std::numeric_limits<T>::max()) {
+		return false;
+	}
+
+	outNumber = (T)number;
+	return true;
+}
+
+// ParseNumber for the value of an option, reporting the usage error
+template <typename T>
+static bool ParseOptionNumber(const std::string& name, const std::string& value, T& outNumber) {
+	if (!ParseNumber(value, outNumber)) {
+		std::cerr << "Invalid " << name << " " << value << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+// name=n,socket=path,identity=address,...,max-queue=n,max-connections=n,uid=n
+static bool ParseTenant(const std::string& value, AgentTenant& outTenant, std::string& outPath) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos) {
+			end = value.size();
+		}
+
+		const std::string field = value.substr(start, end - start);
+		start = end + 1;
+
+		size_t separator = field.find('=');
+		if (separator == std::string::npos) {
+			return false;
+		}
+
+		const std::string key = field.substr(0, separator);
+		const std::string fieldValue = field.substr(separator + 1);
+		if (key == "name") {
+			outTenant.name = fieldValue;
+		}
+		else if (key == "socket") {
+			outPath = fieldValue;
+		}
+		else if (key == "identity") {
+			outTenant.allowedIdentities.push_back(Identity(fieldValue));
+		}
+		else if (key == "max-queue") {
+			if (!ParseNumber(fieldValue, outTenant.maxQueued)) {
+				return false;
+			}
+		}
+		else if (key == "max-connections") {
+			if (!ParseNumber(fieldValue, outTenant.maxConnections)) {
+				return false;
+			}
+		}
+		else if (key == "uid") {
+			if (!ParseNumber(fieldValue, outTenant.uid)) {
+				return false;
+			}
+		}
+		else {
+			return false;
+		}
+	}
+
+	return !outTenant.name.empty() && !outPath.empty();
+}
+
+static int SignFiles(AgentCore& agent, const std::vector<uint8_t>& keyBlob, const std::string& nameSpace, const std::vector<std::string>& paths) {
+	AgentClient client;
+	int failures = 0;
+	std::future<bool> hashed;
+	std::string digest;
+	std::string nextDigest;
+	if (!paths.empty()) {
+		hashed = std::async(std::launch::async, sshsig::HashFile, paths[0], std::ref(nextDigest));
+	}
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		const std::string& path = paths[i];
+		const bool isHashed = hashed.get();
+		digest.swap(nextDigest);
+		if (i + 1 < paths.size()) {
+			hashed = std::async(std::launch::async, sshsig::HashFile, paths[i + 1], std::ref(nextDigest));
+		}
+		if (!isHashed) {
+			std::cerr << "Could not read " << path << std::endl;
+			failures++;
+			continue;
+		}
+
+		const std::vector<uint8_t> request = sshsig::BuildSignRequest(keyBlob, sshsig::BuildSignedData(nameSpace, digest));
+		SharedResponse response;
+		agent.HandleRequest(client, request.data(), request.size(), response);
+		const std::string signature = response ? sshsig::BuildSignature(keyBlob, nameSpace, *response) : std::string();
+		if (signature.empty()) {
+			std::cerr << "No signature for " << path << std::endl;
+			failures++;
+			continue;
+		}
+
+		if (path == "-") {
+			std::cout << signature << std::flush;
+			continue;
+		}
+
+		std::ofstream output(path + ".sig", std::ios::binary | std::ios::trunc);
+		output << signature;
+		if (!output) {
+			std::cerr << "Could not write " << path << ".sig" << std::endl;
+			failures++;
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}
+
+// entries[,ttl-seconds]
+static bool ParseEcdhCache(const std::string& value, size_t& outEntries, long& outTimeToLive) {
+	size_t separator = value.find(',');
+	if (!ParseNumber(value.substr(0, separator), outEntries)) {
+		return false;
+	}
+
+	return separator == std::string::npos || ParseNumber(value.substr(separator + 1), outTimeToLive);
+}
+
+static void PrintSchedulerStats(const char* name, SignScheduler& scheduler) {
+	SignScheduler::Stats stats = scheduler.GetStats();
+	std::cerr << name << ": " << stats.served << " served, " << stats.rejected << " rejected, " << stats.cancelled << " cancelled, " << stats.peakQueued << " queued at most";
+	if (stats.served > 0) {
+		std::cerr << ", wait " << stats.totalWaitUs / stats.served << " us average, " << stats.maxWaitUs << " us max";
+	}
+	std::cerr << std::endl;
+}
+
+// reports the session on stderr, a replay that strayed from its trace fails the run
+static int Finish(AgentCore& agent, const std::vector<ReplayBackend*>& replays, int result) {
+	PrintSchedulerStats("signatures", agent.GetScheduler());
+	PrintSchedulerStats("software key signatures", agent.GetSoftwareScheduler());
+
+	size_t mismatches = 0;
+	for (const ReplayBackend* replay : replays) {
+		mismatches += replay->GetMismatches();
+	}
+	if (!replays.empty()) {
+		std::cerr << "replay: " << mismatches << " mismatches" << std::endl;
+	}
+
+	return mismatches == 0 ? result : 1;
+}
+
+static bool ReadRequest(FILE* input, std::vector<uint8_t>& outRequest) {
+	uint8_t header[4];
+	if (fread(header, 1, sizeof(header), input) != sizeof(header)) {
+		return false;
+	}
+
+	uint32_t length = static_cast<uint32_t>(header[0]) << 24u | static_cast<uint32_t>(header[1]) << 16u |
+		static_cast<uint32_t>(header[2]) << 8u | static_cast<uint32_t>(header[3]);
+
+	outRequest.assign(header, header + sizeof(header));
+	outRequest.resize(sizeof(header) + length);
+	return fread(outRequest.data() + sizeof(header), 1, length, input) == length;
+}
+
+int main(int argc, char** argv) {
+	DevicePool devices;
+	IdentityList identities;
+	AgentCore agent(devices, identities);
+
+	size_t repeat = 0;
+	std::string listenPath;
+	size_t maxQueued = 64;
+	size_t maxPerClient = 16;
+	long signTimeout = -1;
+	std::string knownHostsPath;
+	if (getenv("HOME") != nullptr) {
+		knownHostsPath = std::string(getenv("HOME")) + "/.ssh/known_hosts";
+	}
+	std::vector<std::string> identityArgs;
+	std::vector<std::pair<std::string, std::shared_ptr<const AgentTenant>>> tenants;
+	std::string sshsigNamespace;
+	std::vector<std::string> signPaths;
+	// attached once all options are read, so --record applies wherever it is given
+	std::string tracePath;
+	std::vector<std::unique_ptr<HidBackend>> backends;
+	std::vector<std::unique_ptr<ApduTransport>> transports;
+	// owned by the pool, which outlives them here
+	std::vector<ReplayBackend*> replays;
+	for (int i = 1; i < argc; ++i) {
+		const std::string argument = argv[i];
+		std::string value;
+
+		if (MatchOption(argument, "--record", value)) {
+			tracePath = value;
+		}
+		else if (MatchOption(argument, "--emulator", value)) {
+			backends.push_back(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+		}
+		else if (MatchOption(argument, "--speculos", value)) {
+			std::string host;
+			uint16_t port = SPECULOS_DEFAULT_PORT;
+			if (!ParseSpeculosAddress(value, host, port)) {
+				std::cerr << "Invalid --speculos address " << value << std::endl;
+				return 1;
+			}
+
+			transports.push_back(std::unique_ptr<ApduTransport>(new SpeculosTransport(host, port)));
+		}
+		else if (MatchOption(argument, "--replay", value)) {
+			bool originalTiming = true;
+			size_t modePos = value.rfind(',');
+			if (modePos != std::string::npos && value.substr(modePos + 1) == "fast") {
+				originalTiming = false;
+				value = value.substr(0, modePos);
+			}
+
+			ReplayBackend* replay = new ReplayBackend(value, originalTiming);
+			if (!replay->IsLoaded()) {
+				std::cerr << "Could not load trace " << value << std::endl;
+				delete replay;
+				return 1;
+			}
+
+			replays.push_back(replay);
+			backends.push_back(std::unique_ptr<HidBackend>(replay));
+		}
+		else if (MatchOption(argument, "--repeat", value)) {
+			if (!ParseOptionNumber("--repeat", value, repeat)) {
+				return 1;
+			}
+		}
+		else if (MatchOption(argument, "--listen", value)) {
+			listenPath = value;
+		}
+		else if (MatchOption(argument, "--max-queue", value)) {
+			if (!ParseOptionNumber("--max-queue", value, maxQueued)) {
+				return 1;
+			}
+		}
+		else if (MatchOption(argument, "--max-per-client", value)) {
+			if (!ParseOptionNumber("--max-per-client", value, maxPerClient)) {
+				return 1;
+			}
+		}
+		else if (MatchOption(argument, "--sign-timeout", value)) {
+			if (!ParseOptionNumber("--sign-timeout", value, signTimeout)) {
+				return 1;
+			}
+		}
+		else if (MatchOption(argument, "--known-hosts", value)) {
+			knownHostsPath = value;
+		}
+		else if (MatchOption(argument, "--tenant", value)) {
+			std::shared_ptr<AgentTenant> tenant = std::make_shared<AgentTenant>();
+			std::string tenantPath;
+			if (!ParseTenant(value, *tenant, tenantPath)) {
+				std::cerr << "Invalid tenant " << value << std::endl;
+				return 1;
+			}
+			tenants.push_back(std::make_pair(tenantPath, tenant));
+		}
+		else if (MatchOption(argument, "--identity", value)) {
+			identityArgs.push_back(value);
+		}
+		else if (MatchOption(argument, "--sshsig", value)) {
+			sshsigNamespace = value;
+		}
+		else if (MatchOption(argument, "--ecdh-cache", value)) {
+			size_t entries = 0;
+			long timeToLive = 600;
+			if (!ParseEcdhCache(value, entries, timeToLive)) {
+				std::cerr << "Invalid ECDH cache " << value << std::endl;
+				return 1;
+			}
+			agent.GetEcdhCache().SetLimits(entries, std::chrono::seconds(timeToLive));
+		}
+		else if (argument == "-" || (!argument.empty() && argument[0] != '-')) {
+			signPaths.push_back(argument);
+		}
+		else {
+			std::cerr << "Unknown option " << argument << std::endl;
+			return 1;
+		}
+	}
+
+	// Speculos talks APDUs over TCP, there are no HID reports to record
+	if (!tracePath.empty() && !transports.empty()) {
+		std::cerr << "--record does not apply to --speculos" << std::endl;
+		return 1;
+	}
+
+	devices.SetTracePath(tracePath);
+	for (std::unique_ptr<HidBackend>& backend : backends) {
+		devices.Attach(std::move(backend));
+	}
+	for (std::unique_ptr<ApduTransport>& transport : transports) {
+		devices.Attach(std::move(transport));
+	}
+
+	if (!signPaths.empty() && sshsigNamespace.empty()) {
+		std::cerr << "Files are only signed with --sshsig=namespace" << std::endl;
+		return 1;
+	}
+
+	agent.GetScheduler().SetLimits(maxQueued, maxPerClient);
+	if (signTimeout >= 0) {
+		agent.GetScheduler().SetMaxWait(std::chrono::seconds(signTimeout));
+	}
+
+	std::shared_ptr<KnownHosts> knownHosts = std::make_shared<KnownHosts>();
+	if (!knownHostsPath.empty() && knownHosts->Load(knownHostsPath)) {
+		agent.SetKnownHosts(knownHosts);
+	}
+
+	devices.Refresh();
+	if (!devices.Open()) {
+		std::cerr << "No device with the SSH/PGP app ready" << std::endl;
+		return Finish(agent, replays, 1);
+	}
+
+	// load the public key of every identity up front, like "Get Public Key" in the UI
+	for (const std::string& identityArg : identityArgs) {
+		std::string curve = "nistp256";
+		std::string identStr = identityArg;
+		size_t curvePos = identStr.rfind(',');
+		if (curvePos != std::string::npos) {
+			curve = identStr.substr(curvePos + 1);
+			identStr = identStr.substr(0, curvePos);
+		}
+
+		Identity ident(identStr);
+		ident.name = stringUtil::s2ws(identStr);
+		ident.InitKeyType(curve);
+
+		uint16_t status = 0;
+		ident.pubkey_cached = agent.FetchPublicKey(ident, &status);
+		if (ident.pubkey_cached.Empty()) {
+			std::cerr << "No public key for " << identStr << ", status " << std::hex << status << std::dec << std::endl;
+			return Finish(agent, replays, 1);
+		}
+
+		identities.mIdentities.push_back(ident);
+	}
+
+	if (!sshsigNamespace.empty()) {
+		if (identities.mIdentities.empty()) {
+			std::cerr << "--sshsig needs an --identity to sign with" << std::endl;
+			return 1;
+		}
+
+		int result = SignFiles(agent, identities.mIdentities[0].pubkey_cached.Get(), sshsigNamespace, signPaths);
+		return Finish(agent, replays, result);
+	}
+
+	if (!listenPath.empty() || !tenants.empty()) {
+#ifdef __linux__
+		AgentSocketServer server(agent, listenPath);
+		for (const std::pair<std::string, std::shared_ptr<const AgentTenant>>& tenant : tenants) {
+			server.AddListener(tenant.first, tenant.second);
+		}
+		if (!server.Listen()) {
+			std::cerr << "Could not listen on every socket" << std::endl;
+			return 1;
+		}
+
+		gServer = &server;
+		signal(SIGINT, OnTerminate);
+		signal(SIGTERM, OnTerminate);
+		if (!listenPath.empty()) {
+			std::cerr << "SSH_AUTH_SOCK=" << listenPath << std::endl;
+		}
+		for (const std::pair<std::string, std::shared_ptr<const AgentTenant>>& tenant : tenants) {
+			std::cerr << tenant.second->name << ": SSH_AUTH_SOCK=" << tenant.first << std::endl;
+		}
+		server.Run();
+		gServer = nullptr;
+		return Finish(agent, replays, 0);
+#else
+		std::cerr << "--listen and --tenant are only available on Linux" << std::endl;
+		return 1;
+#endif
+	}
+
+	std::vector<std::vector<uint8_t>> requests;
+	std::vector<uint8_t> request;
+	while (ReadRequest(stdin, request)) {
+		requests.push_back(request);
+	}
+
+	// stdin is one client connection
+	AgentClient client;
+	SharedResponse response;
+	if (repeat == 0) {
+		for (const std::vector<uint8_t>& pending : requests) {
+			agent.HandleRequest(client, pending.data(), pending.size(), response);
+			if (response) {
+				fwrite(response->data(), 1, response->size(), stdout);
+			}
+		}
+		fflush(stdout);
+		return Finish(agent, replays, 0);
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < repeat; ++i) {
+		for (const std::vector<uint8_t>& pending : requests) {
+			agent.HandleRequest(client, pending.data(), pending.size(), response);
+		}
+	}
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+
+	const size_t handled = repeat * requests.size();
+	std::cerr << handled << " requests in " << elapsed.count() / 1000.0 << " ms";
+	if (handled > 0) {
+		std::cerr << ", " << elapsed.count() / handled << " us per request";
+	}
+	std::cerr << std::endl;
+	return Finish(agent, replays, 0);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "apdu.h"
+
+// Raw HID report transport underneath Device.
+// Implemented by hidapi for real hardware; other implementations can stand
+// in for the device without touching the framing or agent code.
+class HidBackend {
+public:
+	virtual ~HidBackend() {
+	}
+
+	virtual bool Open() = 0;
+	virtual void Close() = 0;
+	virtual bool IsOpen() const = 0;
+
+	// returns the number of bytes read, 0 on timeout and -1 on error
+	virtual int Read(uint8_t* data, size_t length, int timeoutMs) = 0;
+
+	// data starts with the report id, returns -1 on error
+	virtual int Write(const uint8_t* data, size_t length) = 0;
+
+	// largest APDU payload the device behind it takes; the stock SSH/PGP app
+	// has no way to tell and only takes short APDUs
+	virtual size_t GetMaxPayload() const {
+		return shortPayloadMax;
+	}
+};
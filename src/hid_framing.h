@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include "apdu.h"
+
+// HID report layout used by the Ledger:
+//  first frame:        channel(2) tag(1) sequence(2) apdu length(2) payload
+//  continuation frame: channel(2) tag(1) sequence(2) payload
+constexpr size_t frameHeaderSize = 5;
+constexpr size_t frameLengthSize = 2;
+constexpr size_t firstFramePayload = packet_size - (frameHeaderSize + frameLengthSize);
+constexpr size_t nextFramePayload = packet_size - frameHeaderSize;
+
+// Splits an APDU into HID output reports.
+// Header and payload are streamed straight into a single reusable report
+// buffer that is prefixed with the report id expected by hid_write.
+class ApduFramer {
+public:
+	ApduFramer() {
+	}
+
+	void Begin(const APDU& apdu) {
+		mApdu = &apdu;
+		mData = nullptr;
+		mOffset = 0;
+		mTotal = apdu.SerializedSize();
+		mSequenceIdx = 0;
+	}
+
+	// frames an already serialized message, such as a response
+	void Begin(const uint8_t* data, size_t length) {
+		mApdu = nullptr;
+		mData = data;
+		mOffset = 0;
+		mTotal = length;
+		mSequenceIdx = 0;
+	}
+
+	// fills the next report, returns false when all frames were produced
+	bool Next() {
+		if ((mApdu == nullptr && mData == nullptr) || (mSequenceIdx > 0 && mOffset == mTotal)) {
+			return false;
+		}
+
+		memset(mReport, 0, sizeof(mReport));
+
+		// report id
+		uint8_t* frame = mReport + 1;
+		frame[0] = (uint8_t)(APDU_CHANNEL >> 8u);
+		frame[1] = (uint8_t)APDU_CHANNEL;
+		frame[2] = APDU_TAG;
+		frame[3] = (uint8_t)(mSequenceIdx >> 8u);
+		frame[4] = (uint8_t)mSequenceIdx;
+
+		size_t offset = frameHeaderSize;
+		size_t capacity = nextFramePayload;
+		if (mSequenceIdx == 0) {
+			frame[5] = (uint8_t)(mTotal >> 8u);
+			frame[6] = (uint8_t)mTotal;
+			offset += frameLengthSize;
+			capacity = firstFramePayload;
+		}
+
+		size_t blockSize = mTotal - mOffset;
+		if (blockSize > capacity) {
+			blockSize = capacity;
+		}
+
+		if (mApdu != nullptr) {
+			mApdu->CopyTo(mOffset, frame + offset, blockSize);
+		}
+		else {
+			memcpy(frame + offset, mData + mOffset, blockSize);
+		}
+		mOffset += blockSize;
+		mSequenceIdx++;
+
+		return true;
+	}
+
+	const uint8_t* Report() const {
+		return mReport;
+	}
+
+	size_t ReportSize() const {
+		return sizeof(mReport);
+	}
+
+private:
+	const APDU* mApdu = nullptr;
+	const uint8_t* mData = nullptr;
+	size_t mOffset = 0;
+	size_t mTotal = 0;
+	uint16_t mSequenceIdx = 0;
+	uint8_t mReport[packet_size + 1] = {0};
+};
+
+// Rebuilds an APDU response one HID report at a time.
+// Only the header of the incoming frame is validated, and the payload is
+// copied once into a buffer that is kept between exchanges.
+class ApduReassembler {
+public:
+	enum class State {
+		Incomplete,
+		Complete,
+		Error
+	};
+
+	ApduReassembler() {
+	}
+
+	void Reset() {
+		mSequenceIdx = 0;
+		mExpected = 0;
+		mReceived = 0;
+		mState = State::Incomplete;
+	}
+
+	State Feed(const uint8_t* report, size_t length) {
+		if (mState != State::Incomplete) {
+			return mState;
+		}
+
+		if (length < frameHeaderSize) {
+			return Fail();
+		}
+
+		const uint16_t channel = ReadShort(report);
+		const uint8_t tag = report[2];
+		const uint16_t sequence = ReadShort(report + 3);
+
+		if (channel != APDU_CHANNEL || tag != APDU_TAG || sequence != mSequenceIdx) {
+			return Fail();
+		}
+
+		size_t offset = frameHeaderSize;
+		if (mSequenceIdx == 0) {
+			if (length < frameHeaderSize + frameLengthSize) {
+				return Fail();
+			}
+
+			mExpected = ReadShort(report + offset);
+			offset += frameLengthSize;
+
+			// a response always carries at least the status word
+			if (mExpected < 2) {
+				return Fail();
+			}
+
+			// grows only, so steady-state exchanges do not allocate
+			if (mBuffer.size() < mExpected) {
+				mBuffer.resize(mExpected);
+			}
+		}
+
+		size_t blockSize = mExpected - mReceived;
+		if (blockSize > length - offset) {
+			blockSize = length - offset;
+		}
+
+		memcpy(mBuffer.data() + mReceived, report + offset, blockSize);
+		mReceived += blockSize;
+		mSequenceIdx++;
+
+		if (mReceived == mExpected) {
+			mState = State::Complete;
+		}
+
+		return mState;
+	}
+
+	// response data without the trailing status word
+	const uint8_t* Data() const {
+		return mBuffer.data();
+	}
+
+	size_t Size() const {
+		return mState == State::Complete ? mExpected - 2 : 0;
+	}
+
+	// whole message including the trailing two bytes, used for commands
+	size_t MessageSize() const {
+		return mState == State::Complete ? mExpected : 0;
+	}
+
+	uint16_t StatusCode() const {
+		if (mState != State::Complete) {
+			return 0;
+		}
+
+		return ReadShort(mBuffer.data() + mExpected - 2);
+	}
+
+private:
+	static uint16_t ReadShort(const uint8_t* data) {
+		return static_cast<uint16_t>(data[0]) << 8u | static_cast<uint16_t>(data[1]);
+	}
+
+	State Fail() {
+		mState = State::Error;
+		return mState;
+	}
+
+	std::vector<uint8_t> mBuffer;
+	uint16_t mSequenceIdx = 0;
+	size_t mExpected = 0;
+	size_t mReceived = 0;
+	State mState = State::Incomplete;
+};
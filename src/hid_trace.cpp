@@ -0,0 +1,228 @@
+#include "hid_trace.h"
+
+#include <cstring>
+#include <thread>
+#include "logger.h"
+
+static const char traceMagic[4] = { 'L', 'P', 'H', 'T' };
+constexpr uint8_t traceVersion = 2;
+
+RecordingBackend::RecordingBackend(std::unique_ptr<HidBackend> backend, const std::string& tracePath)
+	: mBackend(std::move(backend))
+	, mTrace(tracePath, std::ios::binary | std::ios::trunc)
+	, mLastEntry(std::chrono::steady_clock::now()) {
+	if (!mTrace) {
+		LOG_ERR("Could not create trace %s", tracePath.c_str());
+		return;
+	}
+
+	const size_t maxPayload = mBackend->GetMaxPayload();
+	mTrace.write(traceMagic, sizeof(traceMagic));
+	mTrace.put((char)traceVersion);
+	mTrace.put((char)(maxPayload >> 8u));
+	mTrace.put((char)maxPayload);
+}
+
+RecordingBackend::~RecordingBackend() {
+	mTrace.flush();
+}
+
+bool RecordingBackend::Open() {
+	return mBackend->Open();
+}
+
+void RecordingBackend::Close() {
+	mBackend->Close();
+	mTrace.flush();
+}
+
+bool RecordingBackend::IsOpen() const {
+	return mBackend->IsOpen();
+}
+
+int RecordingBackend::Read(uint8_t* data, size_t length, int timeoutMs) {
+	int result = mBackend->Read(data, length, timeoutMs);
+	if (result > 0) {
+		Record(TraceEntryType::Read, data, (size_t)result);
+	}
+	else if (result == 0) {
+		Record(TraceEntryType::ReadTimeout, nullptr, 0);
+	}
+	else {
+		Record(TraceEntryType::Error, nullptr, 0);
+	}
+
+	return result;
+}
+
+int RecordingBackend::Write(const uint8_t* data, size_t length) {
+	int result = mBackend->Write(data, length);
+	Record(result < 0 ? TraceEntryType::Error : TraceEntryType::Write, data, length);
+	return result;
+}
+
+size_t RecordingBackend::GetMaxPayload() const {
+	return mBackend->GetMaxPayload();
+}
+
+void RecordingBackend::Record(TraceEntryType type, const uint8_t* data, size_t length) {
+	if (!mTrace) {
+		return;
+	}
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - mLastEntry).count();
+	uint32_t delayUs = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+	mLastEntry = now;
+
+	uint8_t header[7];
+	header[0] = (uint8_t)type;
+	header[1] = (uint8_t)(delayUs >> 24u);
+	header[2] = (uint8_t)(delayUs >> 16u);
+	header[3] = (uint8_t)(delayUs >> 8u);
+	header[4] = (uint8_t)delayUs;
+	header[5] = (uint8_t)(length >> 8u);
+	header[6] = (uint8_t)length;
+
+	mTrace.write((const char*)header, sizeof(header));
+	if (length > 0) {
+		mTrace.write((const char*)data, length);
+	}
+}
+
+ReplayBackend::ReplayBackend(const std::string& tracePath, bool originalTiming)
+	: mMismatches(0)
+	, mOriginalTiming(originalTiming) {
+	std::ifstream trace(tracePath, std::ios::binary);
+
+	char magic[sizeof(traceMagic)] = { 0 };
+	trace.read(magic, sizeof(magic));
+	const int version = trace.get();
+	if (!trace || memcmp(magic, traceMagic, sizeof(magic)) != 0 || version < 1 || version > traceVersion) {
+		LOG_ERR("Invalid trace %s", tracePath.c_str());
+		return;
+	}
+
+	if (version >= 2) {
+		uint8_t maxPayload[2];
+		if (!trace.read((char*)maxPayload, sizeof(maxPayload))) {
+			LOG_ERR("Invalid trace %s", tracePath.c_str());
+			return;
+		}
+		mMaxPayload = (size_t)maxPayload[0] << 8u | maxPayload[1];
+	}
+
+	uint8_t header[7];
+	while (trace.read((char*)header, sizeof(header))) {
+		Entry entry;
+		entry.type = (TraceEntryType)header[0];
+		entry.delayUs = (uint32_t)header[1] << 24u | (uint32_t)header[2] << 16u | (uint32_t)header[3] << 8u | (uint32_t)header[4];
+		entry.data.resize((size_t)header[5] << 8u | header[6]);
+		if (!entry.data.empty() && !trace.read((char*)entry.data.data(), entry.data.size())) {
+			LOG_WARN("Trace %s is truncated", tracePath.c_str());
+			break;
+		}
+
+		mEntries.push_back(std::move(entry));
+	}
+
+	mLoaded = true;
+}
+
+ReplayBackend::~ReplayBackend() {
+}
+
+bool ReplayBackend::Open() {
+	if (!mLoaded) {
+		return false;
+	}
+
+	mOpen = true;
+	mLastEntry = std::chrono::steady_clock::now();
+	return true;
+}
+
+void ReplayBackend::Close() {
+	mOpen = false;
+}
+
+bool ReplayBackend::IsOpen() const {
+	return mOpen;
+}
+
+int ReplayBackend::Read(uint8_t* data, size_t length, int timeoutMs) {
+	// skip writes the session did not make, the next read is what matters
+	while (mPosition < mEntries.size() && mEntries[mPosition].type == TraceEntryType::Write) {
+		mMismatches++;
+		mPosition++;
+	}
+
+	if (!mOpen || mPosition == mEntries.size()) {
+		mOpen = false;
+		return -1;
+	}
+
+	const Entry& entry = mEntries[mPosition++];
+	WaitFor(entry);
+
+	if (entry.type == TraceEntryType::ReadTimeout) {
+		return 0;
+	}
+	else if (entry.type != TraceEntryType::Read) {
+		mOpen = false;
+		return -1;
+	}
+
+	size_t readLength = entry.data.size() < length ? entry.data.size() : length;
+	memcpy(data, entry.data.data(), readLength);
+	return (int)readLength;
+}
+
+int ReplayBackend::Write(const uint8_t* data, size_t length) {
+	if (!mOpen || mPosition == mEntries.size()) {
+		mOpen = false;
+		return -1;
+	}
+
+	const Entry& entry = mEntries[mPosition];
+	if (entry.type != TraceEntryType::Write && entry.type != TraceEntryType::Error) {
+		// extra write compared to the recording, keep the position for the reads
+		LOG_WARN("Replay: unexpected write");
+		mMismatches++;
+		return (int)length;
+	}
+
+	mPosition++;
+	WaitFor(entry);
+
+	if (entry.data.size() != length || memcmp(entry.data.data(), data, length) != 0) {
+		LOG_WARN("Replay: written report differs from recording");
+		mMismatches++;
+	}
+
+	if (entry.type == TraceEntryType::Error) {
+		mOpen = false;
+		return -1;
+	}
+
+	return (int)length;
+}
+
+size_t ReplayBackend::GetMaxPayload() const {
+	return mMaxPayload;
+}
+
+bool ReplayBackend::IsLoaded() const {
+	return mLoaded;
+}
+
+size_t ReplayBackend::GetMismatches() const {
+	return mMismatches;
+}
+
+void ReplayBackend::WaitFor(const Entry& entry) {
+	if (mOriginalTiming) {
+		std::this_thread::sleep_until(mLastEntry + std::chrono::microseconds(entry.delayUs));
+	}
+	mLastEntry = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hid_backend.h"
+
+// Binary trace of HID traffic:
+//  header: "LPHT" version(1) max payload(2), version 1 has no max payload
+//  entry:  type(1) microseconds since previous entry(4) length(2) data
+enum class TraceEntryType : uint8_t {
+	Write = 1,
+	Read = 2,
+	ReadTimeout = 3,
+	Error = 4
+};
+
+// Passes everything through to another backend and records it with timestamps.
+class RecordingBackend : public HidBackend {
+public:
+	RecordingBackend(std::unique_ptr<HidBackend> backend, const std::string& tracePath);
+	~RecordingBackend();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override;
+	int Write(const uint8_t* data, size_t length) override;
+	size_t GetMaxPayload() const override;
+
+private:
+	void Record(TraceEntryType type, const uint8_t* data, size_t length);
+
+	std::unique_ptr<HidBackend> mBackend;
+	std::ofstream mTrace;
+	std::chrono::steady_clock::time_point mLastEntry;
+};
+
+// Serves a recorded session back, at the recorded pace or as fast as possible.
+// Written reports are compared with the recorded ones byte for byte.
+class ReplayBackend : public HidBackend {
+public:
+	ReplayBackend(const std::string& tracePath, bool originalTiming);
+	~ReplayBackend();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override;
+	int Write(const uint8_t* data, size_t length) override;
+	// as recorded, so the session chunks its commands the same way
+	size_t GetMaxPayload() const override;
+
+	bool IsLoaded() const;
+	size_t GetMismatches() const;
+
+private:
+	struct Entry {
+		TraceEntryType type;
+		uint32_t delayUs;
+		std::vector<uint8_t> data;
+	};
+
+	void WaitFor(const Entry& entry);
+
+	std::vector<Entry> mEntries;
+	size_t mPosition = 0;
+	// read by the driver thread while the device worker replays
+	std::atomic<size_t> mMismatches;
+	size_t mMaxPayload = shortPayloadMax;
+	bool mOriginalTiming = true;
+	bool mLoaded = false;
+	bool mOpen = false;
+	std::chrono::steady_clock::time_point mLastEntry;
+};
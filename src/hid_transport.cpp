@@ -0,0 +1,86 @@
+#include "hid_transport.h"
+
+#include "logger.h"
+
+// continuation frames follow right after the first one
+constexpr int frameTimeoutMs = 1000;
+
+HidTransport::HidTransport() {
+}
+
+HidTransport::HidTransport(std::unique_ptr<HidBackend> backend)
+	: mDevice(std::move(backend)) {
+}
+
+HidTransport::~HidTransport() {
+}
+
+bool HidTransport::Open() {
+	return mDevice.Open();
+}
+
+void HidTransport::Close() {
+	mDevice.Close();
+}
+
+bool HidTransport::IsOpen() const {
+	return mDevice.IsOpen();
+}
+
+bool HidTransport::IsAppReady() const {
+	return mDevice.IsAppReady();
+}
+
+void HidTransport::SetAppReady(bool ready) {
+	mDevice.SetAppReady(ready);
+}
+
+size_t HidTransport::GetMaxPayload() const {
+	return mDevice.GetMaxPayload();
+}
+
+bool HidTransport::Exchange(const APDU& apdu, ApduResponse& outResponse) {
+	outResponse.valid = false;
+	outResponse.statusCode = 0;
+	outResponse.data.Clear();
+	if (!mDevice.IsOpen()) {
+		LOG_ERR("Device not connected");
+		return false;
+	}
+
+	mFramer.Begin(apdu);
+	while (mFramer.Next()) {
+		if (mDevice.Write(mFramer.Report(), mFramer.ReportSize()) < 0) {
+			LOG_ERR("Error while writing to device");
+			return false;
+		}
+	}
+
+	ReportView report;
+	if (!mDevice.Read(report, userTimeoutMs)) {
+		return false;
+	}
+
+	mReassembler.Reset();
+	while (true) {
+		ApduReassembler::State state = mReassembler.Feed(report.data, report.size);
+		if (state == ApduReassembler::State::Complete) {
+			break;
+		}
+		else if (state == ApduReassembler::State::Error) {
+			LOG_ERR("Invalid APDU response frame");
+			return false;
+		}
+
+		if (!mDevice.Read(report, frameTimeoutMs)) {
+			LOG_ERR("Error while reading from device");
+			return false;
+		}
+	}
+
+	// the cleared buffer keeps its capacity, a reused response is not reallocated
+	outResponse.valid = true;
+	outResponse.statusCode = mReassembler.StatusCode();
+	outResponse.data.PushBack((uint8_t*)mReassembler.Data(), (uint32_t)mReassembler.Size());
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+
+#include "apdu_transport.h"
+#include "hid_framing.h"
+#include "ledger_device.h"
+
+// APDUs over the Ledger HID framing.
+class HidTransport : public ApduTransport {
+public:
+	HidTransport();
+	explicit HidTransport(std::unique_ptr<HidBackend> backend);
+	~HidTransport();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	bool IsAppReady() const override;
+	void SetAppReady(bool ready) override;
+
+	bool Exchange(const APDU& apdu, ApduResponse& outResponse) override;
+	size_t GetMaxPayload() const override;
+
+private:
+	Device mDevice;
+	ApduFramer mFramer;
+	ApduReassembler mReassembler;
+};
@@ -1,7 +1,6 @@
 #include "identity.h"
 
-#include "window.h"
-#include "application.h"
+#include <cmath>
 #include "encodeUtil.h"
 #include "stringUtil.h"
 #include "logger.h"
@@ -20,8 +19,14 @@ Identity::~Identity() {
 }
 
 void Identity::InitKeyType(std::string keyTypeStr) {
-	Application* app = Window::GetPtr()->GetApplication();
-	keyType = app->GetKeyTypeByIndex(app->GetKeyTypeIndexByName(keyTypeStr));
+	for (const KeyType& supported : GetSupportedKeyTypes()) {
+		if (supported.GetName() == keyTypeStr) {
+			keyType = supported;
+			return;
+		}
+	}
+
+	LOG_WARN("Unknown key type %s", keyTypeStr.c_str());
 }
 
 bool Identity::FromString(std::string identStr) {
@@ -38,7 +43,7 @@ bool Identity::FromString(std::string identStr) {
 	protocol = base_match[1].str();
 	user = base_match[2].str();
 	host = base_match[3].str();
-	port = std::stoi(base_match[4].str());
+	port = base_match[4].matched ? std::stoi(base_match[4].str()) : 0;
 	path = base_match[5].str();
 
 	return true;
@@ -104,8 +109,8 @@ ByteArray Identity::GetAddress(bool ecdh) const {
 	return address;
 }
 
-ByteArray Identity::GetPathBIP32() const {
-	ByteArray path = GetAddress(false);
+ByteArray Identity::GetPathBIP32(bool ecdh) const {
+	ByteArray path = GetAddress(ecdh);
 	uint8_t numInts = (uint8_t)std::floor((path.Size() + 1) / 4);
 
 	ByteArray result;
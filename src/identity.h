@@ -4,13 +4,15 @@
 #include <iostream>
 #include "key_type.h"
 #include "bytearray.h"
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
-#include <cryptopp\cryptlib.h>
-#include <cryptopp\sha.h>
-#include <cryptopp\hex.h>
-#include <cryptopp\files.h>
-#include <cryptopp\channels.h>
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/hex.h>
+#include <cryptopp/files.h>
+#include <cryptopp/channels.h>
 
 class Identity {
 public:
@@ -22,7 +24,8 @@ public:
 	bool FromString(std::string identStr);
 	std::string ToString() const;
 
-	ByteArray GetPathBIP32() const;
+	// key path for SSH signing, or for ECDH (purpose 17')
+	ByteArray GetPathBIP32(bool ecdh = false) const;
 
 	// private:
 	std::wstring name;
@@ -30,9 +33,11 @@ public:
 	std::wstring user;
 	std::wstring host;
 	std::wstring path;
-	int port;
+	int port = 0;
 
+#ifdef _WIN32
 	TCHAR regKeyName[255] = {0};
+#endif
 	KeyType keyType;
 	ByteArray pubkey_cached;
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 class KeyType {
 public:
@@ -53,4 +54,14 @@ private:
 	std::string mPrefix;
 	uint8_t mOctet;
 	uint8_t mP2;
-};
\ No newline at end of file
+};
+
+// curves the SSH/PGP app signs with
+inline const std::vector<KeyType>& GetSupportedKeyTypes() {
+	static const std::vector<KeyType> keyTypes = {
+		KeyType("nistp256", "ecdsa-sha2-", 0x04, 0x01),
+		KeyType("ed25519", "ssh-", 0x04, 0x02)
+	};
+
+	return keyTypes;
+}
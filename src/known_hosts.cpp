@@ -0,0 +1,104 @@
+#include "known_hosts.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include "encodeUtil.h"
+#include "logger.h"
+
+// default port, written without brackets
+constexpr int sshPort = 22;
+
+const std::string hashedPrefix = "|1|";
+
+static std::string ToLower(std::string value) {
+	std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	return value;
+}
+
+bool KnownHosts::Load(const std::string& path) {
+	std::ifstream file(path);
+	if (!file) {
+		LOG_DBG("No known hosts at %s", path.c_str());
+		return false;
+	}
+
+	mEntries.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		ParseLine(line);
+	}
+
+	LOG_DBG("Loaded %u known host keys", (unsigned)mEntries.size());
+	return true;
+}
+
+size_t KnownHosts::GetNumKeys() const {
+	return mEntries.size();
+}
+
+bool KnownHosts::Matches(const uint8_t* hostKey, size_t length, const std::string& host, int port) const {
+	if (host.empty()) {
+		return false;
+	}
+
+	std::string name = ToLower(host);
+	if (port != 0 && port != sshPort) {
+		name = "[" + name + "]:" + std::to_string(port);
+	}
+
+	typedef std::unordered_multimap<std::string, Entry>::const_iterator Iterator;
+	std::pair<Iterator, Iterator> range = mEntries.equal_range(std::string((const char*)hostKey, length));
+	for (Iterator it = range.first; it != range.second; ++it) {
+		const Entry& entry = it->second;
+		if (std::find(entry.names.begin(), entry.names.end(), name) != entry.names.end()) {
+			return true;
+		}
+
+		for (const std::pair<std::string, std::string>& hashed : entry.hashedNames) {
+			if (encodeUtils::makeHmacSha1(hashed.first, name) == hashed.second) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+void KnownHosts::ParseLine(const std::string& line) {
+	// hosts keytype base64-key [comment]
+	std::istringstream fields(line);
+	std::string hosts;
+	std::string keyType;
+	std::string key;
+	if (!(fields >> hosts >> keyType >> key) || hosts[0] == '#' || hosts[0] == '@') {
+		return;
+	}
+
+	Entry entry;
+	std::istringstream names(hosts);
+	std::string name;
+	while (std::getline(names, name, ',')) {
+		if (name.compare(0, hashedPrefix.size(), hashedPrefix) == 0) {
+			size_t separator = name.find('|', hashedPrefix.size());
+			if (separator == std::string::npos) {
+				continue;
+			}
+
+			const std::string salt = encodeUtils::decodeBase64(name.substr(hashedPrefix.size(), separator - hashedPrefix.size()));
+			const std::string hash = encodeUtils::decodeBase64(name.substr(separator + 1));
+			entry.hashedNames.push_back(std::make_pair(salt, hash));
+		}
+		else if (name.find_first_of("*?!") == std::string::npos) {
+			entry.names.push_back(ToLower(name));
+		}
+	}
+
+	const std::string blob = encodeUtils::decodeBase64(key);
+	if (blob.empty() || (entry.names.empty() && entry.hashedNames.empty())) {
+		return;
+	}
+
+	mEntries.insert(std::make_pair(blob, std::move(entry)));
+}
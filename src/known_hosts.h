@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Host keys of an OpenSSH known_hosts file, to tell which host a key belongs to.
+// Plain and hashed (|1|salt|hash) host names are understood; wildcard patterns,
+// negations and marked lines (@cert-authority, @revoked) are skipped.
+class KnownHosts {
+public:
+	bool Load(const std::string& path);
+
+	size_t GetNumKeys() const;
+
+	// whether hostKey is recorded for host on port, entries off port 22 read [host]:port
+	bool Matches(const uint8_t* hostKey, size_t length, const std::string& host, int port) const;
+
+private:
+	struct Entry {
+		std::vector<std::string> names;
+		// salt and HMAC-SHA1 of the name
+		std::vector<std::pair<std::string, std::string>> hashedNames;
+	};
+
+	void ParseLine(const std::string& line);
+
+	// key blob -> hosts it was seen on
+	std::unordered_multimap<std::string, Entry> mEntries;
+};
@@ -1,26 +1,65 @@
 #include "ledger_device.h"
 
 #include "logger.h"
-#include <chrono>   // get tick
-#include <thread>   // sleep
+#include <atomic>
 
 #define LEDGER_VID 0x2c97
 #define LEDGER_USAGE_PAGE 0xffa0
 #define NANOS_PID 0x1005
 
-Device::Device() {
-	LOG_DBG("HIDAPI Init.");
-	hid_init();
+// hid_exit tears down every handle, only call it for the last backend
+static std::atomic<int> gHidApiUsers(0);
+
+HidApiBackend::HidApiBackend() {
+	if (gHidApiUsers++ == 0) {
+		LOG_DBG("HIDAPI Init.");
+		hid_init();
+	}
 }
 
-Device::~Device() {
-	LOG_DBG("HIDAPI Exit.");
+HidApiBackend::HidApiBackend(const std::string& path)
+	: HidApiBackend() {
+	mPath = path;
+}
+
+HidApiBackend::~HidApiBackend() {
 	Close();
-	hid_exit();
+	if (--gHidApiUsers == 0) {
+		LOG_DBG("HIDAPI Exit.");
+		hid_exit();
+	}
 }
 
-bool Device::Open() {
-	hid_device* result = hid_open(LEDGER_VID, NANOS_PID, NULL);
+std::vector<std::string> HidApiBackend::Enumerate() {
+	std::vector<std::string> paths;
+
+	hid_init();
+	hid_device_info* devices = hid_enumerate(LEDGER_VID, 0);
+	for (hid_device_info* info = devices; info != nullptr; info = info->next) {
+		// some platforms do not report the usage page, fall back to the first interface
+		bool isLedgerInterface = info->usage_page == LEDGER_USAGE_PAGE;
+		if (info->usage_page == 0 && info->interface_number == 0) {
+			isLedgerInterface = true;
+		}
+
+		if (isLedgerInterface && info->path != nullptr) {
+			paths.push_back(info->path);
+		}
+	}
+	hid_free_enumeration(devices);
+
+	return paths;
+}
+
+bool HidApiBackend::Open() {
+	hid_device* result = nullptr;
+	if (!mPath.empty()) {
+		result = hid_open_path(mPath.c_str());
+	}
+	else {
+		result = hid_open(LEDGER_VID, NANOS_PID, NULL);
+	}
+
 	if (result != NULL) {
 		mDevice = result;
 		return true;
@@ -29,66 +68,99 @@ bool Device::Open() {
 	return false;
 }
 
-void Device::Close() {
-	hid_close(mDevice);
+void HidApiBackend::Close() {
+	if (mDevice != nullptr) {
+		hid_close(mDevice);
+		mDevice = nullptr;
+	}
 }
 
-size_t Device::Read(ByteArray& out) {
+bool HidApiBackend::IsOpen() const {
+	return mDevice != nullptr;
+}
 
-	hid_set_nonblocking(mDevice, 0);
+int HidApiBackend::Read(uint8_t* data, size_t length, int timeoutMs) {
+	return hid_read_timeout(mDevice, data, length, timeoutMs);
+}
 
-	mReadBuffer.Clear();
+int HidApiBackend::Write(const uint8_t* data, size_t length) {
+	return hid_write(mDevice, data, length);
+}
 
-	// read into vector, push back onto buffer
-	std::vector<uint8_t> buf(packet_size);
-	size_t n = hid_read(mDevice, buf.data(), packet_size);
-	for (uint32_t i = 0; i < packet_size; ++i) {
-		mReadBuffer.PushBack(buf[i]);
-	}
+Device::Device()
+	: mBackend(new HidApiBackend()) {
+}
 
-	if (n == 0) {
-		auto err = hid_error(mDevice);
-		wprintf(err);
-		return 0;
-	}
+Device::Device(std::unique_ptr<HidBackend> backend)
+	: mBackend(std::move(backend)) {
+}
+
+Device::~Device() {
+	Close();
+}
 
-	if (n != packet_size) {
-		return 0;
+bool Device::Open() {
+	// keep the existing handle instead of opening a second one
+	if (mBackend->IsOpen()) {
+		return true;
 	}
 
-	hid_set_nonblocking(mDevice, 1);
+	mDeviceAppReady = false;
+	return mBackend->Open();
+}
 
-	return out.PushBack(mReadBuffer);
+void Device::Close() {
+	mBackend->Close();
+	mDeviceAppReady = false;
 }
 
-uint32_t Device::Read(ByteArray& outBuffer, uint32_t timeout) {
-	std::chrono::high_resolution_clock::time_point startTimeout = std::chrono::high_resolution_clock::now();
+bool Device::IsOpen() const {
+	return mBackend->IsOpen();
+}
 
-	hid_set_nonblocking(mDevice, 0);
+bool Device::IsAppReady() const {
+	return mDeviceAppReady;
+}
 
-	int32_t readByteLen = 0;
-	while (readByteLen == 0) {
-		readByteLen = this->Read(outBuffer);
+void Device::SetAppReady(bool ready) {
+	mDeviceAppReady = ready;
+}
 
-		// repeat while read not finished:
-		if (readByteLen == 0) {
-			if (std::chrono::high_resolution_clock::now() - startTimeout > std::chrono::seconds(timeout)) {
-				LOG_ERR("read timeout (forgot to push button?)");
-				return 0;
-			}
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-		}
-		else if (readByteLen == -1) {
-			LOG_ERR("Error reading from device");
-			return 0;
-		}
-	}
+size_t Device::GetMaxPayload() const {
+	return mBackend->GetMaxPayload();
+}
+
+bool Device::Read(ReportView& outReport, int timeoutMs) {
+	// hid_read fills the next ring slot in place
+	uint8_t* slot = mReportRing[mRingIndex];
+	mRingIndex = (mRingIndex + 1) % reportRingSlots;
 
-	hid_set_nonblocking(mDevice, 1);
+	int readByteLen = mBackend->Read(slot, packet_size, timeoutMs);
+	if (readByteLen == 0) {
+		LOG_ERR("read timeout (forgot to push button?)");
+		return false;
+	}
+	else if (readByteLen < 0) {
+		// most likely unplugged, reconnect on next use
+		LOG_ERR("Error reading from device");
+		Close();
+		return false;
+	}
 
-	return readByteLen;
+	outReport.data = slot;
+	outReport.size = (size_t)readByteLen;
+	return true;
 }
 
 int Device::Write(const ByteArray& inBuffer) {
-	return hid_write(mDevice, inBuffer.Get().data(), inBuffer.Size());
+	return Write(inBuffer.Get().data(), inBuffer.Size());
+}
+
+int Device::Write(const uint8_t* data, size_t length) {
+	int result = mBackend->Write(data, length);
+	if (result < 0) {
+		Close();
+	}
+
+	return result;
 }
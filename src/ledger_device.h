@@ -1,25 +1,71 @@
 #pragma once
 
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef _WIN32
 #include "hidapi\hidapi\hidapi.h"
+#else
+#include <hidapi/hidapi.h>
+#endif
+#include "apdu.h"
 #include "bytearray.h"
+#include "hid_backend.h"
 
-constexpr size_t packet_size = 64;
+// number of reports kept before a slot is reused
+constexpr size_t reportRingSlots = 8;
+
+// Points into Device's report ring, valid until reportRingSlots more reads.
+struct ReportView {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+class HidApiBackend : public HidBackend {
+public:
+	HidApiBackend();
+	explicit HidApiBackend(const std::string& path);
+	~HidApiBackend();
+
+	// paths of all attached ledger interfaces
+	static std::vector<std::string> Enumerate();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override;
+	int Write(const uint8_t* data, size_t length) override;
+
+private:
+	std::string mPath;
+	hid_device* mDevice = nullptr;
+};
 
 class Device {
 public:
 	Device();
+	explicit Device(std::unique_ptr<HidBackend> backend);
 	~Device();
 
 	bool Open();
 	void Close();
+	bool IsOpen() const;
+
+	bool IsAppReady() const;
+	void SetAppReady(bool ready);
 
-	size_t Read(ByteArray& outBuffer);
-	uint32_t Read(ByteArray& outBuffer, uint32_t timeout);
+	size_t GetMaxPayload() const;
+
+	bool Read(ReportView& outReport, int timeoutMs);
 
 	int Write(const ByteArray& inBuffer);
-	
+	int Write(const uint8_t* data, size_t length);
+
 private:
 	bool mDeviceAppReady = false;
-	hid_device* mDevice = nullptr;
-	ByteArray mReadBuffer;
+	std::unique_ptr<HidBackend> mBackend;
+
+	uint8_t mReportRing[reportRingSlots][packet_size];
+	size_t mRingIndex = 0;
 };
@@ -1,9 +1,71 @@
 #include "window.h"
 
+#include <string>
+#include "emulated_device.h"
+#include "hid_trace.h"
+#include "logger.h"
+#include "speculos_transport.h"
+#include "stringUtil.h"
+
+// finds --name or --name=value, value is empty when not given
+static bool FindOption(const std::wstring& commandLine, const std::wstring& name, std::string& outValue) {
+	size_t optionPos = commandLine.find(name);
+	if (optionPos == std::wstring::npos) {
+		return false;
+	}
+
+	std::wstring option = commandLine.substr(optionPos, commandLine.find(L' ', optionPos) - optionPos);
+	size_t valuePos = option.find(L'=');
+	outValue = valuePos != std::wstring::npos ? stringUtil::ws2s(option.substr(valuePos + 1)) : std::string();
+	return true;
+}
+
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow) {
 	Window* window = Window::GetPtr();
+	std::wstring commandLine = pCmdLine != nullptr ? pCmdLine : L"";
+	std::string value;
+
+	// capture the HID traffic of plugged in and attached devices: --record=file
+	const bool recording = FindOption(commandLine, L"--record", value) && !value.empty();
+	if (recording) {
+		window->GetApplication()->RecordDevices(value);
+	}
+
 	window->Init();
 
+	// serve requests from the software device, for testing without hardware
+	if (FindOption(commandLine, L"--emulator", value)) {
+		window->GetApplication()->AttachDevice(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+	}
+
+	// talk raw APDUs to a speculos instance: --speculos[=host[:port]];
+	// it has no HID traffic, so it is left out rather than silently not recorded
+	if (FindOption(commandLine, L"--speculos", value) && recording) {
+		LOG_ERR("--record does not apply to --speculos, not attached");
+	}
+	else if (FindOption(commandLine, L"--speculos", value)) {
+		std::string host;
+		uint16_t port = SPECULOS_DEFAULT_PORT;
+		if (ParseSpeculosAddress(value, host, port)) {
+			window->GetApplication()->AttachDevice(std::unique_ptr<ApduTransport>(new SpeculosTransport(host, port)));
+		}
+		else {
+			LOG_ERR("Invalid --speculos address %s, not attached", value.c_str());
+		}
+	}
+
+	// serve a recorded session back: --replay=file[,fast]
+	if (FindOption(commandLine, L"--replay", value) && !value.empty()) {
+		bool originalTiming = true;
+		size_t modePos = value.rfind(',');
+		if (modePos != std::string::npos && value.substr(modePos + 1) == "fast") {
+			originalTiming = false;
+			value = value.substr(0, modePos);
+		}
+
+		window->GetApplication()->AttachDevice(std::unique_ptr<HidBackend>(new ReplayBackend(value, originalTiming)));
+	}
+
 	HWND win = window->Make(hInstance);
 	if (win) {
 		MSG msg;
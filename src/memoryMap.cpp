@@ -14,6 +14,14 @@ bool MemoryMap::Open() {
 	}
 
 	mDataPtr = MapViewOfFile(mFilemapHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+
+	// an existing mapping keeps the size its creator gave it
+	MEMORY_BASIC_INFORMATION info;
+	mMappedSize = 0;
+	if (mDataPtr != NULL && VirtualQuery(mDataPtr, &info, sizeof(info)) == sizeof(info)) {
+		mMappedSize = info.RegionSize;
+	}
+
 	return true;
 }
 
@@ -23,13 +31,16 @@ uint32_t MemoryMap::Seek(uint32_t inPos) {
 }
 
 bool MemoryMap::Write(ByteArray& data) {
-	uint32_t size = data.Size();
-	if (mPosition + size >= mLength) {
+	return Write(data.Get().data(), data.Size());
+}
+
+bool MemoryMap::Write(const uint8_t* data, size_t size) {
+	if (mPosition > mMappedSize || size > mMappedSize - mPosition) {
 		return false;
 	}
 
 	uint8_t* dest = (uint8_t*)mDataPtr + mPosition;
-	RtlMoveMemory(dest, data.Get().data(), size);
+	RtlMoveMemory(dest, data, size);
 
 	mPosition += size;
 	return true;
@@ -48,12 +59,24 @@ uint8_t* MemoryMap::ReadBytes(uint32_t len) {
 
 uint32_t MemoryMap::ReadInt() {
 	uint8_t* bytes = ReadBytes(4);
-	return  (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+	uint32_t value = (bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+	free(bytes);
+	return value;
+}
+
+const uint8_t* MemoryMap::GetData() const {
+	return (const uint8_t*)mDataPtr;
+}
+
+size_t MemoryMap::GetSize() const {
+	return mDataPtr != NULL ? mMappedSize : 0;
 }
 
 void MemoryMap::Close() {
 	UnmapViewOfFile(mDataPtr);
 	CloseHandle(mFilemapHandle);
+	mDataPtr = NULL;
+	mMappedSize = 0;
 }
 
 std::string MemoryMap::GetName() {
@@ -6,6 +6,7 @@
 #include <string>
 #include "bytearray.h"
 
+// size of the mapping when it is created here, clients create their own
 constexpr uint32_t AGENT_MAX_MSGLEN = 8192;
 
 class MemoryMap {
@@ -13,15 +14,22 @@ public:
 	explicit MemoryMap(const std::string& inName);
 	bool Open();
 	uint32_t Seek(uint32_t inPos);
+	// false, with nothing written, when the data does not fit the mapping
 	bool Write(ByteArray& data);
+	bool Write(const uint8_t* data, size_t size);
 	uint8_t* ReadBytes(uint32_t len);
 	uint32_t ReadInt();
+
+	// the mapped view, to parse in place, as large as the client made it
+	const uint8_t* GetData() const;
+	size_t GetSize() const;
 	void Close();
 	std::string GetName();
 
 private:
 	HANDLE mFilemapHandle = INVALID_HANDLE_VALUE;
 	size_t mLength = AGENT_MAX_MSGLEN;
+	size_t mMappedSize = 0;
 	std::string mName;
 	uint32_t mPosition = 0;
 	LPVOID mDataPtr = NULL;
@@ -0,0 +1,209 @@
+#include "sign_scheduler.h"
+
+#include <algorithm>
+#include "logger.h"
+
+// a client still waiting after this long has most likely given up
+constexpr std::chrono::milliseconds defaultMaxWait(60000);
+
+SignScheduler::SignScheduler(size_t maxQueued, size_t maxPerClient)
+	: mMaxQueued(maxQueued)
+	, mMaxPerClient(maxPerClient)
+	, mMaxWait(defaultMaxWait) {
+}
+
+SignScheduler::~SignScheduler() {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRunning = false;
+	}
+
+	mCondition.notify_all();
+	for (std::thread& thread : mThreads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+	// whoever waits on a job still queued gets an answer
+	for (std::unordered_map<uint64_t, std::deque<Pending>>::value_type& entry : mQueues) {
+		for (Pending& pending : entry.second) {
+			pending.job(true);
+		}
+	}
+}
+
+void SignScheduler::SetLimits(size_t maxQueued, size_t maxPerClient) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMaxQueued = maxQueued;
+	mMaxPerClient = maxPerClient;
+}
+
+void SignScheduler::SetConcurrency(size_t concurrency) {
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mConcurrency = concurrency > 0 ? concurrency : 1;
+		if (!mRunning) {
+			return;
+		}
+
+		// threads are only added, extra ones wait while the limit is lower
+		while (mThreads.size() < mConcurrency) {
+			mThreads.push_back(std::thread(&SignScheduler::Run, this));
+		}
+	}
+
+	mCondition.notify_all();
+}
+
+void SignScheduler::SetMaxWait(std::chrono::milliseconds maxWait) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mMaxWait = maxWait;
+}
+
+bool SignScheduler::Submit(uint64_t clientId, Job job, const CancelFlag& cancel, size_t maxClientQueued) {
+	std::vector<Job> dropped;
+	bool accepted = false;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mThreads.empty()) {
+			mThreads.push_back(std::thread(&SignScheduler::Run, this));
+		}
+
+		// requests nobody waits for any more make room before anyone is refused
+		const size_t maxPerClient = maxClientQueued != 0 ? maxClientQueued : mMaxPerClient;
+		std::unordered_map<uint64_t, std::deque<Pending>>::iterator it = mQueues.find(clientId);
+		if (mStats.queued >= mMaxQueued || (it != mQueues.end() && it->second.size() >= maxPerClient)) {
+			RemoveStale(dropped);
+		}
+
+		std::deque<Pending>& queue = mQueues[clientId];
+		if (mStats.queued >= mMaxQueued || queue.size() >= maxPerClient) {
+			LOG_WARN("Sign queue full, %u queued", (unsigned)mStats.queued);
+			if (queue.empty()) {
+				mQueues.erase(clientId);
+			}
+			mStats.rejected++;
+		}
+		else {
+			// a client gets back in line once its queue ran empty
+			if (queue.empty()) {
+				mTurns.push_back(clientId);
+			}
+
+			Pending pending;
+			pending.job = std::move(job);
+			pending.cancel = cancel;
+			pending.queuedAt = std::chrono::steady_clock::now();
+			queue.push_back(std::move(pending));
+			mStats.queued++;
+			if (mStats.queued > mStats.peakQueued) {
+				mStats.peakQueued = mStats.queued;
+			}
+			accepted = true;
+		}
+	}
+
+	// told outside the lock, they may submit again
+	for (Job& droppedJob : dropped) {
+		droppedJob(true);
+	}
+
+	if (accepted) {
+		mCondition.notify_one();
+	}
+	return accepted;
+}
+
+SignScheduler::Stats SignScheduler::GetStats() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	Stats stats = mStats;
+	stats.clients = mTurns.size();
+	return stats;
+}
+
+void SignScheduler::Run() {
+	std::unique_lock<std::mutex> lock(mMutex);
+	while (true) {
+		mCondition.wait(lock, [this]() { return !mRunning || (!mTurns.empty() && mStats.active < mConcurrency); });
+		if (!mRunning) {
+			return;
+		}
+
+		// first client in line, which goes to the back if it has more queued
+		const uint64_t clientId = mTurns.front();
+		mTurns.pop_front();
+
+		std::deque<Pending>& queue = mQueues[clientId];
+		Pending pending = std::move(queue.front());
+		queue.pop_front();
+		if (queue.empty()) {
+			mQueues.erase(clientId);
+		}
+		else {
+			mTurns.push_back(clientId);
+		}
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		mStats.queued--;
+		if (IsStale(pending, now)) {
+			LOG_DBG("Sign request dropped, client gone or deadline passed");
+			mStats.cancelled++;
+			lock.unlock();
+			pending.job(true);
+			lock.lock();
+			continue;
+		}
+
+		const uint64_t waitUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - pending.queuedAt).count();
+		mStats.active++;
+		mStats.totalWaitUs += waitUs;
+		if (waitUs > mStats.maxWaitUs) {
+			mStats.maxWaitUs = waitUs;
+		}
+
+		lock.unlock();
+		pending.job(false);
+		lock.lock();
+
+		mStats.active--;
+		mStats.served++;
+		mCondition.notify_one();
+	}
+}
+
+bool SignScheduler::IsStale(const Pending& pending, std::chrono::steady_clock::time_point now) const {
+	if (IsCancelled(pending.cancel)) {
+		return true;
+	}
+
+	return mMaxWait.count() > 0 && now - pending.queuedAt > mMaxWait;
+}
+
+void SignScheduler::RemoveStale(std::vector<Job>& outDropped) {
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	std::unordered_map<uint64_t, std::deque<Pending>>::iterator it = mQueues.begin();
+	while (it != mQueues.end()) {
+		std::deque<Pending>& queue = it->second;
+		for (std::deque<Pending>::iterator pending = queue.begin(); pending != queue.end();) {
+			if (!IsStale(*pending, now)) {
+				++pending;
+				continue;
+			}
+
+			outDropped.push_back(std::move(pending->job));
+			pending = queue.erase(pending);
+			mStats.queued--;
+			mStats.cancelled++;
+		}
+
+		if (queue.empty()) {
+			mTurns.erase(std::find(mTurns.begin(), mTurns.end(), it->first));
+			it = mQueues.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
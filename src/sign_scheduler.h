@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cancel_flag.h"
+
+// Orders sign requests in front of the devices.
+// Every client has its own FIFO queue and clients are served round-robin, so a
+// batch job queuing many signatures gets one turn per round like anyone else.
+// At most the configured number of jobs run at once, one per device; a request
+// that would exceed the queue bounds is refused at once instead of waiting.
+// Jobs whose client went away or that waited past the deadline are dropped
+// before they reach a device.
+class SignScheduler {
+public:
+	// runs with cancelled set when the job is dropped instead
+	typedef std::function<void(bool cancelled)> Job;
+
+	struct Stats {
+		size_t queued = 0;
+		size_t peakQueued = 0;
+		size_t active = 0;
+		size_t clients = 0;
+		uint64_t served = 0;
+		uint64_t rejected = 0;
+		uint64_t cancelled = 0;
+		uint64_t totalWaitUs = 0;
+		uint64_t maxWaitUs = 0;
+	};
+
+	SignScheduler(size_t maxQueued = 64, size_t maxPerClient = 16);
+	~SignScheduler();
+
+	// bounds on waiting jobs, over all clients and for a single one
+	void SetLimits(size_t maxQueued, size_t maxPerClient);
+
+	// jobs running at the same time, at least one
+	void SetConcurrency(size_t concurrency);
+
+	// longest a job may wait for its turn, zero for no deadline
+	void SetMaxWait(std::chrono::milliseconds maxWait);
+
+	// queues job behind the other jobs of clientId, false when the queue is full;
+	// maxClientQueued replaces the per client bound when not zero
+	bool Submit(uint64_t clientId, Job job, const CancelFlag& cancel = CancelFlag(), size_t maxClientQueued = 0);
+
+	Stats GetStats();
+
+private:
+	struct Pending {
+		Job job;
+		CancelFlag cancel;
+		std::chrono::steady_clock::time_point queuedAt;
+	};
+
+	void Run();
+	bool IsStale(const Pending& pending, std::chrono::steady_clock::time_point now) const;
+	void RemoveStale(std::vector<Job>& outDropped);
+
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::unordered_map<uint64_t, std::deque<Pending>> mQueues;
+	// clients with queued jobs, in service order
+	std::deque<uint64_t> mTurns;
+	std::vector<std::thread> mThreads;
+
+	size_t mMaxQueued;
+	size_t mMaxPerClient;
+	size_t mConcurrency = 1;
+	std::chrono::milliseconds mMaxWait;
+	bool mRunning = true;
+	Stats mStats;
+};
@@ -0,0 +1,28 @@
+#include "signer.h"
+
+#include "agent_core.h"
+
+void Signer::WriteSignResponse(ByteArray& response, const std::string& keyType, const uint8_t* signature, size_t length) {
+	SshWriter writer(response.Get());
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH2_AGENT_SIGN_RESPONSE);
+	const size_t signatureStart = writer.BeginLength();
+	writer.WriteString(keyType);
+	writer.WriteString(signature, length);
+	writer.EndLength(signatureStart);
+	writer.EndLength(messageStart);
+}
+
+void Signer::WriteEcdsaSignResponse(ByteArray& response, const std::string& keyType, const ByteSpan& r, const ByteSpan& s) {
+	SshWriter writer(response.Get());
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH2_AGENT_SIGN_RESPONSE);
+	const size_t signatureStart = writer.BeginLength();
+	writer.WriteString(keyType);
+	const size_t valueStart = writer.BeginLength();
+	writer.WriteMpint(r.data, r.size);
+	writer.WriteMpint(s.data, s.size);
+	writer.EndLength(valueStart);
+	writer.EndLength(signatureStart);
+	writer.EndLength(messageStart);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "bytearray.h"
+#include "cancel_flag.h"
+#include "identity.h"
+#include "ssh_wire.h"
+
+// Makes the signature for SSH2_AGENTC_SIGN_REQUEST with the key of an identity,
+// on a device or in memory. Called on the agent's sign threads, possibly
+// several at once.
+class Signer {
+public:
+	virtual ~Signer() {
+	}
+
+	// framed SSH2_AGENT_SIGN_RESPONSE into response, false when no signature was made
+	virtual bool Sign(const Identity& ident, const ByteSpan& data, ByteArray& response, const CancelFlag& cancel) = 0;
+
+protected:
+	// string(key type, string(signature)), as ssh-ed25519 has it
+	static void WriteSignResponse(ByteArray& response, const std::string& keyType, const uint8_t* signature, size_t length);
+
+	// string(key type, string(mpint r, mpint s)), as ECDSA has it
+	static void WriteEcdsaSignResponse(ByteArray& response, const std::string& keyType, const ByteSpan& r, const ByteSpan& s);
+};
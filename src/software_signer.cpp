@@ -0,0 +1,225 @@
+#include "software_signer.h"
+
+#include <cryptopp/eccrypto.h>
+#include <cryptopp/oids.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/xed25519.h>
+
+#include "logger.h"
+
+typedef CryptoPP::ECDSA<CryptoPP::ECP, CryptoPP::SHA256> Ecdsa;
+
+const std::string ed25519KeyType = "ssh-ed25519";
+const std::string ecdsaKeyType = "ecdsa-sha2-nistp256";
+const std::string ecdsaCurveName = "nistp256";
+
+constexpr size_t ed25519KeySize = 32;
+constexpr size_t nistp256FieldSize = 32;
+
+// Crypto++ random pools must not be shared between threads
+static CryptoPP::AutoSeededRandomPool& GetThreadRng() {
+	thread_local CryptoPP::AutoSeededRandomPool rng;
+	return rng;
+}
+
+static std::string ToString(const ByteSpan& span) {
+	return std::string((const char*)span.data, span.size);
+}
+
+SoftwareSigner::SoftwareSigner() {
+}
+
+bool SoftwareSigner::Add(SshReader& message) {
+	ByteSpan keyType;
+	if (!message.ReadString(keyType)) {
+		return false;
+	}
+
+	std::shared_ptr<Secret> key = std::make_shared<Secret>();
+	key->keyType = ToString(keyType);
+	SshWriter blob(key->blob);
+	if (key->keyType == ed25519KeyType) {
+		// string public key, string seed and public key
+		ByteSpan publicKey;
+		ByteSpan privateKey;
+		if (!message.ReadString(publicKey) || !message.ReadString(privateKey) ||
+			publicKey.size != ed25519KeySize || privateKey.size != 2 * ed25519KeySize) {
+			return false;
+		}
+
+		CryptoPP::ed25519::Signer signer(privateKey.data);
+		const CryptoPP::ed25519PrivateKey& derived = static_cast<const CryptoPP::ed25519PrivateKey&>(signer.GetPrivateKey());
+		if (memcmp(derived.GetPublicKeyBytePtr(), publicKey.data, ed25519KeySize) != 0) {
+			LOG_WARN("Ed25519 key does not match its public key");
+			return false;
+		}
+
+		key->secret.Assign(privateKey.data, ed25519KeySize);
+		blob.WriteString(key->keyType);
+		blob.WriteString(publicKey);
+	}
+	else if (key->keyType == ecdsaKeyType) {
+		// string curve, string public point, mpint private exponent
+		ByteSpan curve;
+		ByteSpan publicKey;
+		ByteSpan exponent;
+		if (!message.ReadString(curve) || ToString(curve) != ecdsaCurveName || !message.ReadString(publicKey) || !message.ReadMpint(exponent)) {
+			return false;
+		}
+
+		Ecdsa::PrivateKey privateKey;
+		privateKey.Initialize(CryptoPP::ASN1::secp256r1(), CryptoPP::Integer(exponent.data, exponent.size));
+		if (!privateKey.Validate(GetThreadRng(), 1)) {
+			return false;
+		}
+
+		// uncompressed point: 0x04, x, y
+		Ecdsa::PublicKey derived;
+		privateKey.MakePublicKey(derived);
+		uint8_t point[1 + 2 * nistp256FieldSize];
+		point[0] = 0x04;
+		derived.GetPublicElement().x.Encode(point + 1, nistp256FieldSize);
+		derived.GetPublicElement().y.Encode(point + 1 + nistp256FieldSize, nistp256FieldSize);
+		if (publicKey.size != sizeof(point) || memcmp(point, publicKey.data, sizeof(point)) != 0) {
+			LOG_WARN("ECDSA key does not match its public key");
+			return false;
+		}
+
+		key->secret.Assign(exponent.data, exponent.size);
+		blob.WriteString(key->keyType);
+		blob.WriteString(curve);
+		blob.WriteString(publicKey);
+	}
+	else {
+		LOG_WARN("Keys of type %s cannot be added", key->keyType.c_str());
+		return false;
+	}
+
+	ByteSpan comment;
+	if (!message.ReadString(comment)) {
+		return false;
+	}
+	key->comment = ToString(comment);
+
+	// adding a key again replaces it, with the new comment
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<std::shared_ptr<const Secret>>::iterator it = mKeys.begin();
+	while (it != mKeys.end() && (*it)->blob != key->blob) {
+		++it;
+	}
+	if (it != mKeys.end()) {
+		*it = key;
+	}
+	else {
+		mKeys.push_back(key);
+	}
+	mGeneration++;
+	return true;
+}
+
+bool SoftwareSigner::Remove(const uint8_t* keyBlob, size_t length) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (std::vector<std::shared_ptr<const Secret>>::iterator it = mKeys.begin(); it != mKeys.end(); ++it) {
+		const std::vector<uint8_t>& blob = (*it)->blob;
+		if (blob.size() == length && memcmp(blob.data(), keyBlob, length) == 0) {
+			mKeys.erase(it);
+			mGeneration++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void SoftwareSigner::RemoveAll() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	mKeys.clear();
+	mGeneration++;
+}
+
+bool SoftwareSigner::HasKey(const uint8_t* keyBlob, size_t length) {
+	return FindSecret(keyBlob, length) != nullptr;
+}
+
+std::vector<SoftwareSigner::Key> SoftwareSigner::GetKeys() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<Key> keys;
+	keys.reserve(mKeys.size());
+	for (const std::shared_ptr<const Secret>& secret : mKeys) {
+		Key key;
+		key.blob = secret->blob;
+		key.comment = secret->comment;
+		keys.push_back(key);
+	}
+
+	return keys;
+}
+
+uint64_t SoftwareSigner::GetGeneration() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mGeneration;
+}
+
+bool SoftwareSigner::Sign(const Identity& ident, const ByteSpan& data, ByteArray& response, const CancelFlag& cancel) {
+	const std::vector<uint8_t>& keyBlob = ident.pubkey_cached.Get();
+	std::shared_ptr<const Secret> key = FindSecret(keyBlob.data(), keyBlob.size());
+	if (!key || IsCancelled(cancel)) {
+		return false;
+	}
+
+	// an idle signer of the key, or a new one when all are busy
+	std::unique_ptr<CryptoPP::PK_Signer> signer;
+	{
+		std::lock_guard<std::mutex> lock(key->signersMutex);
+		if (!key->signers.empty()) {
+			signer = std::move(key->signers.back());
+			key->signers.pop_back();
+		}
+	}
+	if (!signer) {
+		if (key->keyType == ed25519KeyType) {
+			signer.reset(new CryptoPP::ed25519::Signer(key->secret.data()));
+		}
+		else {
+			Ecdsa::PrivateKey privateKey;
+			privateKey.Initialize(CryptoPP::ASN1::secp256r1(), CryptoPP::Integer(key->secret.data(), key->secret.size()));
+			signer.reset(new Ecdsa::Signer(privateKey));
+		}
+	}
+
+	std::vector<uint8_t> signature(signer->MaxSignatureLength());
+	const size_t length = signer->SignMessage(GetThreadRng(), data.data, data.size, signature.data());
+
+	// a removed key takes its signers along once the last signature is made
+	{
+		std::lock_guard<std::mutex> lock(key->signersMutex);
+		key->signers.push_back(std::move(signer));
+	}
+
+	if (key->keyType == ed25519KeyType) {
+		WriteSignResponse(response, key->keyType, signature.data(), length);
+		return true;
+	}
+
+	// r and s of equal size, one after the other
+	ByteSpan r;
+	r.data = signature.data();
+	r.size = length / 2;
+	ByteSpan s;
+	s.data = signature.data() + r.size;
+	s.size = length - r.size;
+	WriteEcdsaSignResponse(response, key->keyType, r, s);
+	return true;
+}
+
+std::shared_ptr<const SoftwareSigner::Secret> SoftwareSigner::FindSecret(const uint8_t* keyBlob, size_t length) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	for (const std::shared_ptr<const Secret>& key : mKeys) {
+		if (key->blob.size() == length && memcmp(key->blob.data(), keyBlob, length) == 0) {
+			return key;
+		}
+	}
+
+	return nullptr;
+}
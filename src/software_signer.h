@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cryptopp/cryptlib.h>
+#include <cryptopp/secblock.h>
+
+#include "signer.h"
+
+// Keys added by clients with SSH2_AGENTC_ADD_IDENTITY, Ed25519 and ECDSA P-256,
+// held in memory only and gone when the agent stops.
+// Signing needs no device and no confirmation. It runs on whatever thread
+// calls Sign; a Crypto++ signer is used by one thread at a time and kept
+// with its key while idle, so it goes away with the key.
+class SoftwareSigner : public Signer {
+public:
+	struct Key {
+		std::vector<uint8_t> blob;
+		std::string comment;
+	};
+
+	SoftwareSigner();
+
+	// key fields of SSH2_AGENTC_ADD_IDENTITY, after the message type;
+	// false when malformed, of another type or when the keys do not match
+	bool Add(SshReader& message);
+
+	bool Remove(const uint8_t* keyBlob, size_t length);
+	void RemoveAll();
+
+	bool HasKey(const uint8_t* keyBlob, size_t length);
+
+	// in the order added
+	std::vector<Key> GetKeys();
+
+	// changes whenever a key is added or removed
+	uint64_t GetGeneration();
+
+	// signs with the key of ident.pubkey_cached
+	bool Sign(const Identity& ident, const ByteSpan& data, ByteArray& response, const CancelFlag& cancel) override;
+
+private:
+	struct Secret {
+		std::string keyType;
+		std::vector<uint8_t> blob;
+		std::string comment;
+		// Ed25519 seed or ECDSA private exponent
+		CryptoPP::SecByteBlock secret;
+		// signers not in use at the moment
+		mutable std::mutex signersMutex;
+		mutable std::vector<std::unique_ptr<CryptoPP::PK_Signer>> signers;
+	};
+
+	std::shared_ptr<const Secret> FindSecret(const uint8_t* keyBlob, size_t length);
+
+	std::mutex mMutex;
+	std::vector<std::shared_ptr<const Secret>> mKeys;
+	uint64_t mGeneration = 0;
+};
@@ -0,0 +1,212 @@
+#include "speculos_transport.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef int socklen_t;
+#define CLOSE_SOCKET closesocket
+#define SEND_FLAGS 0
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define INVALID_SOCKET (-1)
+#define CLOSE_SOCKET close
+// a closed emulator fails the send instead of killing the process with SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+#endif
+
+#include <vector>
+#include "logger.h"
+
+bool ParseSpeculosAddress(const std::string& value, std::string& outHost, uint16_t& outPort) {
+	outHost = "127.0.0.1";
+	outPort = SPECULOS_DEFAULT_PORT;
+
+	std::string host = value;
+	const size_t portPos = value.rfind(':');
+	if (portPos != std::string::npos) {
+		// digits only, at most five of them
+		const std::string port = value.substr(portPos + 1);
+		if (port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos) {
+			return false;
+		}
+
+		const unsigned long number = std::stoul(port);
+		if (number < 1 || number > 65535) {
+			return false;
+		}
+
+		outPort = (uint16_t)number;
+		host = value.substr(0, portPos);
+	}
+
+	if (!host.empty()) {
+		outHost = host;
+	}
+
+	return true;
+}
+
+SpeculosTransport::SpeculosTransport(const std::string& host, uint16_t port)
+	: mHost(host)
+	, mPort(port) {
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+SpeculosTransport::~SpeculosTransport() {
+	Close();
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+bool SpeculosTransport::Open() {
+	if (IsOpen()) {
+		return true;
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* addresses = nullptr;
+	const std::string port = std::to_string(mPort);
+	if (getaddrinfo(mHost.c_str(), port.c_str(), &hints, &addresses) != 0) {
+		LOG_ERR("Could not resolve speculos host %s", mHost.c_str());
+		return false;
+	}
+
+	for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+		auto fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (fd == INVALID_SOCKET) {
+			continue;
+		}
+
+		if (connect(fd, address->ai_addr, (socklen_t)address->ai_addrlen) == 0) {
+			mSocket = (intptr_t)fd;
+			break;
+		}
+		CLOSE_SOCKET(fd);
+	}
+	freeaddrinfo(addresses);
+
+	if (!IsOpen()) {
+		LOG_ERR("Could not connect to speculos at %s:%d", mHost.c_str(), mPort);
+		return false;
+	}
+
+	// the emulated user gets as long as a real one to confirm
+#ifdef _WIN32
+	DWORD timeout = userTimeoutMs;
+#else
+	timeval timeout = { userTimeoutMs / 1000, (userTimeoutMs % 1000) * 1000 };
+#endif
+	setsockopt(mSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+	mAppReady = false;
+	return true;
+}
+
+void SpeculosTransport::Close() {
+	if (IsOpen()) {
+		CLOSE_SOCKET(mSocket);
+		mSocket = -1;
+	}
+	mAppReady = false;
+}
+
+bool SpeculosTransport::IsOpen() const {
+	return mSocket != -1;
+}
+
+bool SpeculosTransport::IsAppReady() const {
+	return mAppReady;
+}
+
+void SpeculosTransport::SetAppReady(bool ready) {
+	mAppReady = ready;
+}
+
+bool SpeculosTransport::Exchange(const APDU& apdu, ApduResponse& outResponse) {
+	outResponse.valid = false;
+	outResponse.statusCode = 0;
+	outResponse.data.Clear();
+	if (!IsOpen()) {
+		LOG_ERR("Speculos not connected");
+		return false;
+	}
+
+	const size_t apduSize = apdu.SerializedSize();
+	mRequest.resize(4 + apduSize);
+	mRequest[0] = (uint8_t)(apduSize >> 24u);
+	mRequest[1] = (uint8_t)(apduSize >> 16u);
+	mRequest[2] = (uint8_t)(apduSize >> 8u);
+	mRequest[3] = (uint8_t)apduSize;
+	apdu.CopyTo(0, mRequest.data() + 4, apduSize);
+
+	if (!SendAll(mRequest.data(), mRequest.size())) {
+		LOG_ERR("Error while writing to speculos");
+		Close();
+		return false;
+	}
+
+	uint8_t header[4];
+	if (!ReceiveAll(header, sizeof(header))) {
+		LOG_ERR("Error while reading from speculos");
+		Close();
+		return false;
+	}
+
+	const uint32_t dataLength = (uint32_t)header[0] << 24u | (uint32_t)header[1] << 16u |
+		(uint32_t)header[2] << 8u | (uint32_t)header[3];
+
+	// data followed by the status word
+	outResponse.data.Get().resize(dataLength);
+	uint8_t statusWord[2];
+	if (!ReceiveAll(outResponse.data.Get().data(), dataLength) || !ReceiveAll(statusWord, sizeof(statusWord))) {
+		LOG_ERR("Error while reading from speculos");
+		Close();
+		outResponse.data.Clear();
+		return false;
+	}
+
+	outResponse.valid = true;
+	outResponse.statusCode = (uint16_t)(statusWord[0] << 8u | statusWord[1]);
+	return true;
+}
+
+bool SpeculosTransport::SendAll(const uint8_t* data, size_t length) {
+	while (length > 0) {
+		auto sent = send(mSocket, (const char*)data, (int)length, SEND_FLAGS);
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		length -= (size_t)sent;
+	}
+
+	return true;
+}
+
+bool SpeculosTransport::ReceiveAll(uint8_t* data, size_t length) {
+	while (length > 0) {
+		auto received = recv(mSocket, (char*)data, (int)length, 0);
+		if (received <= 0) {
+			return false;
+		}
+		data += received;
+		length -= (size_t)received;
+	}
+
+	return true;
+}
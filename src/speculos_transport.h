@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "apdu_transport.h"
+
+constexpr uint16_t SPECULOS_DEFAULT_PORT = 9999;
+
+// [host][:port] as given on the command line, missing parts keep the defaults;
+// false for a port that is not a number in 1..65535
+bool ParseSpeculosAddress(const std::string& value, std::string& outHost, uint16_t& outPort);
+
+// Raw APDUs to the Speculos emulator over its TCP APDU port.
+// Requests are sent as length(4) apdu, answers come back as
+// length(4) data status(2), no HID framing involved.
+class SpeculosTransport : public ApduTransport {
+public:
+	explicit SpeculosTransport(const std::string& host = "127.0.0.1", uint16_t port = SPECULOS_DEFAULT_PORT);
+	~SpeculosTransport();
+
+	bool Open() override;
+	void Close() override;
+	bool IsOpen() const override;
+
+	bool IsAppReady() const override;
+	void SetAppReady(bool ready) override;
+
+	bool Exchange(const APDU& apdu, ApduResponse& outResponse) override;
+
+private:
+	bool SendAll(const uint8_t* data, size_t length);
+	bool ReceiveAll(uint8_t* data, size_t length);
+
+	std::string mHost;
+	uint16_t mPort = SPECULOS_DEFAULT_PORT;
+	intptr_t mSocket = -1;
+	bool mAppReady = false;
+	// length prefixed command, kept between exchanges
+	std::vector<uint8_t> mRequest;
+};
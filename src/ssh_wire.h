@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// borrowed bytes, valid as long as the buffer they point into
+struct ByteSpan {
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+};
+
+// Bounds-checked reader for SSH wire format fields (RFC 4251).
+// Strings and mpints are returned as spans into the buffer, nothing is copied.
+// After the first failed read every read fails.
+class SshReader {
+public:
+	SshReader(const uint8_t* data, size_t size)
+		: mData(data)
+		, mSize(data != nullptr ? size : 0) {
+	}
+
+	bool ReadByte(uint8_t& out) {
+		if (!Ensure(1)) {
+			return false;
+		}
+
+		out = mData[mOffset++];
+		return true;
+	}
+
+	bool ReadUint32(uint32_t& out) {
+		if (!Ensure(4)) {
+			return false;
+		}
+
+		const uint8_t* field = mData + mOffset;
+		out = static_cast<uint32_t>(field[0]) << 24u | static_cast<uint32_t>(field[1]) << 16u |
+			static_cast<uint32_t>(field[2]) << 8u | static_cast<uint32_t>(field[3]);
+		mOffset += 4;
+		return true;
+	}
+
+	bool ReadString(ByteSpan& out) {
+		uint32_t length = 0;
+		if (!ReadUint32(length) || !Ensure(length)) {
+			mFailed = true;
+			return false;
+		}
+
+		out.data = mData + mOffset;
+		out.size = length;
+		mOffset += length;
+		return true;
+	}
+
+	// two's complement big endian, as stored; rejects negative values
+	bool ReadMpint(ByteSpan& out) {
+		if (!ReadString(out)) {
+			return false;
+		}
+
+		if (out.size > 0 && (out.data[0] & 0x80) != 0) {
+			mFailed = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	// the unread rest of the buffer
+	ByteSpan Rest() const {
+		ByteSpan rest;
+		rest.data = mData + mOffset;
+		rest.size = mFailed ? 0 : mSize - mOffset;
+		return rest;
+	}
+
+	size_t Remaining() const {
+		return mFailed ? 0 : mSize - mOffset;
+	}
+
+	bool Failed() const {
+		return mFailed;
+	}
+
+private:
+	bool Ensure(size_t length) {
+		if (mFailed || length > mSize - mOffset) {
+			mFailed = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	const uint8_t* mData;
+	size_t mSize;
+	size_t mOffset = 0;
+	bool mFailed = false;
+};
+
+// Appends SSH wire format fields to a caller owned buffer.
+// Length prefixes of enclosing fields are reserved up front and patched once
+// their content is written, so nested messages are encoded in one pass.
+// Reusing the buffer keeps its capacity, steady-state encoding does not allocate.
+class SshWriter {
+public:
+	explicit SshWriter(std::vector<uint8_t>& out)
+		: mOut(out) {
+	}
+
+	void WriteByte(uint8_t value) {
+		mOut.push_back(value);
+	}
+
+	void WriteUint32(uint32_t value) {
+		uint8_t field[4] = { (uint8_t)(value >> 24u), (uint8_t)(value >> 16u), (uint8_t)(value >> 8u), (uint8_t)value };
+		mOut.insert(mOut.end(), field, field + 4);
+	}
+
+	void WriteString(const uint8_t* data, size_t length) {
+		WriteUint32((uint32_t)length);
+		mOut.insert(mOut.end(), data, data + length);
+	}
+
+	void WriteString(const std::string& value) {
+		WriteString((const uint8_t*)value.data(), value.size());
+	}
+
+	void WriteString(const ByteSpan& value) {
+		WriteString(value.data, value.size);
+	}
+
+	// positive big endian magnitude, normalized to the shortest mpint encoding
+	void WriteMpint(const uint8_t* data, size_t length) {
+		while (length > 0 && data[0] == 0) {
+			data++;
+			length--;
+		}
+
+		const bool padded = length > 0 && (data[0] & 0x80) != 0;
+		WriteUint32((uint32_t)(length + (padded ? 1 : 0)));
+		if (padded) {
+			mOut.push_back(0x00);
+		}
+		mOut.insert(mOut.end(), data, data + length);
+	}
+
+	// starts a length prefixed field, pass the result to EndLength once its content is written
+	size_t BeginLength() {
+		const size_t offset = mOut.size();
+		WriteUint32(0);
+		return offset;
+	}
+
+	void EndLength(size_t offset) {
+		PatchUint32(offset, (uint32_t)(mOut.size() - offset - 4));
+	}
+
+	// overwrites a uint32 written earlier, such as a count known only at the end
+	void PatchUint32(size_t offset, uint32_t value) {
+		mOut[offset + 0] = (uint8_t)(value >> 24u);
+		mOut[offset + 1] = (uint8_t)(value >> 16u);
+		mOut[offset + 2] = (uint8_t)(value >> 8u);
+		mOut[offset + 3] = (uint8_t)value;
+	}
+
+	size_t Size() const {
+		return mOut.size();
+	}
+
+private:
+	std::vector<uint8_t>& mOut;
+};
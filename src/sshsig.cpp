@@ -0,0 +1,199 @@
+#include "sshsig.h"
+
+#include <cstdio>
+#include <cryptopp/sha.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "agent_core.h"
+#include "encodeUtil.h"
+#include "logger.h"
+
+const std::string magic = "SSHSIG";
+const std::string hashAlgorithm = "sha512";
+constexpr uint32_t signatureVersion = 1;
+
+// mapped at once, small enough for a 32-bit address space
+constexpr uint64_t mapWindowSize = 64ull * 1024 * 1024;
+
+constexpr size_t readChunkSize = 64 * 1024;
+
+// base64 line length of ssh-keygen
+constexpr size_t armorLineLength = 70;
+
+static std::string FinalDigest(CryptoPP::SHA512& hash) {
+	std::string digest(CryptoPP::SHA512::DIGESTSIZE, '\0');
+	hash.Final((CryptoPP::byte*)&digest[0]);
+	return digest;
+}
+
+static bool HashStream(FILE* input, std::string& outDigest) {
+	CryptoPP::SHA512 hash;
+	std::vector<uint8_t> chunk(readChunkSize);
+	size_t numRead = 0;
+	while ((numRead = fread(chunk.data(), 1, chunk.size(), input)) > 0) {
+		hash.Update(chunk.data(), numRead);
+	}
+	if (ferror(input)) {
+		return false;
+	}
+
+	outDigest = FinalDigest(hash);
+	return true;
+}
+
+bool sshsig::HashFile(const std::string& path, std::string& outDigest) {
+	if (path == "-") {
+		return HashStream(stdin, outDigest);
+	}
+
+	CryptoPP::SHA512 hash;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		LOG_ERR("Could not open %s", path.c_str());
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// an empty file cannot be mapped
+	const uint64_t size = (uint64_t)fileSize.QuadPart;
+	HANDLE mapping = size > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	if (size > 0 && mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+
+	bool hashed = true;
+	for (uint64_t offset = 0; offset < size; offset += mapWindowSize) {
+		const size_t length = (size_t)(size - offset < mapWindowSize ? size - offset : mapWindowSize);
+		const void* view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32u), (DWORD)offset, length);
+		if (view == NULL) {
+			hashed = false;
+			break;
+		}
+
+		hash.Update((const CryptoPP::byte*)view, length);
+		UnmapViewOfFile(view);
+	}
+
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOG_ERR("Could not open %s", path.c_str());
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(fd, &status) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// pipes and devices are not mapped, they are read as they come
+	if (!S_ISREG(status.st_mode)) {
+		FILE* input = fdopen(fd, "rb");
+		bool hashed = input != nullptr && HashStream(input, outDigest);
+		if (input != nullptr) {
+			fclose(input);
+		}
+		else {
+			close(fd);
+		}
+		return hashed;
+	}
+
+	// windows start on multiples of their size, which is page aligned
+	bool hashed = true;
+	const uint64_t size = (uint64_t)status.st_size;
+	for (uint64_t offset = 0; offset < size; offset += mapWindowSize) {
+		const size_t length = (size_t)(size - offset < mapWindowSize ? size - offset : mapWindowSize);
+		void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+		if (view == MAP_FAILED) {
+			hashed = false;
+			break;
+		}
+
+		madvise(view, length, MADV_SEQUENTIAL);
+		hash.Update((const CryptoPP::byte*)view, length);
+		munmap(view, length);
+	}
+	close(fd);
+#endif
+
+	if (!hashed) {
+		LOG_ERR("Could not read %s", path.c_str());
+		return false;
+	}
+
+	outDigest = FinalDigest(hash);
+	return true;
+}
+
+std::vector<uint8_t> sshsig::BuildSignedData(const std::string& nameSpace, const std::string& digest) {
+	std::vector<uint8_t> signedData(magic.begin(), magic.end());
+	SshWriter writer(signedData);
+	writer.WriteString(nameSpace);
+	// reserved
+	writer.WriteString(std::string());
+	writer.WriteString(hashAlgorithm);
+	writer.WriteString(digest);
+	return signedData;
+}
+
+std::vector<uint8_t> sshsig::BuildSignRequest(const std::vector<uint8_t>& keyBlob, const std::vector<uint8_t>& signedData) {
+	// key blob, data, flags
+	std::vector<uint8_t> request;
+	SshWriter writer(request);
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH2_AGENTC_SIGN_REQUEST);
+	writer.WriteString(keyBlob.data(), keyBlob.size());
+	writer.WriteString(signedData.data(), signedData.size());
+	writer.WriteUint32(0);
+	writer.EndLength(messageStart);
+	return request;
+}
+
+std::string sshsig::BuildSignature(const std::vector<uint8_t>& keyBlob, const std::string& nameSpace, const std::vector<uint8_t>& signResponse) {
+	// length, SSH2_AGENT_SIGN_RESPONSE, string(signature)
+	SshReader reader(signResponse.data(), signResponse.size());
+	uint32_t length = 0;
+	uint8_t type = 0;
+	ByteSpan signature;
+	if (!reader.ReadUint32(length) || !reader.ReadByte(type) || type != SSH2_AGENT_SIGN_RESPONSE || !reader.ReadString(signature)) {
+		return {};
+	}
+
+	std::vector<uint8_t> blob(magic.begin(), magic.end());
+	SshWriter writer(blob);
+	writer.WriteUint32(signatureVersion);
+	writer.WriteString(keyBlob.data(), keyBlob.size());
+	writer.WriteString(nameSpace);
+	writer.WriteString(std::string());
+	writer.WriteString(hashAlgorithm);
+	writer.WriteString(signature);
+
+	const std::string encoded = encodeUtils::encodeBase64(std::string(blob.begin(), blob.end()));
+	std::string armored = "-----BEGIN SSH SIGNATURE-----\n";
+	for (size_t offset = 0; offset < encoded.size(); offset += armorLineLength) {
+		armored += encoded.substr(offset, armorLineLength) + "\n";
+	}
+	armored += "-----END SSH SIGNATURE-----\n";
+	return armored;
+}
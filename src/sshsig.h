@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// SSH signatures of files and other data, as made and checked by ssh-keygen -Y
+// (OpenSSH PROTOCOL.sshsig). The input is hashed here with SHA-512 and only
+// the short signed-data structure around the digest goes to the signer, so a
+// file of any size costs one signature exchange.
+namespace sshsig {
+	// SHA-512 of a file read through a memory map a window at a time, "-" reads stdin
+	bool HashFile(const std::string& path, std::string& outDigest);
+
+	// what the key signs: magic, namespace, reserved, hash algorithm, digest
+	std::vector<uint8_t> BuildSignedData(const std::string& nameSpace, const std::string& digest);
+
+	// framed SSH2_AGENTC_SIGN_REQUEST for the signed data
+	std::vector<uint8_t> BuildSignRequest(const std::vector<uint8_t>& keyBlob, const std::vector<uint8_t>& signedData);
+
+	// armored signature from a framed SSH2_AGENT_SIGN_RESPONSE, empty when the signer failed
+	std::string BuildSignature(const std::vector<uint8_t>& keyBlob, const std::string& nameSpace, const std::vector<uint8_t>& signResponse);
+}
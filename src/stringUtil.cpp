@@ -1,8 +1,14 @@
 #include "stringUtil.h"
 
+#ifdef _WIN32
 #include "window.h"
+#else
+#include <codecvt>
+#include <locale>
+#endif
 
 namespace stringUtil {
+#ifdef _WIN32
 	std::wstring s2ws(const std::string& s) {
 		size_t slength = s.length() + 1;
 		size_t len = ::MultiByteToWideChar(CP_ACP, 0, s.c_str(), slength, 0, 0); 
@@ -18,4 +24,16 @@ namespace stringUtil {
 		::WideCharToMultiByte(CP_ACP, 0, s.c_str(), slength, &r[0], wlength, 0, 0); 
 		return r;
 	}
+#else
+	// no code pages outside Windows, strings are UTF-8
+	std::wstring s2ws(const std::string& s) {
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		return converter.from_bytes(s);
+	}
+
+	std::string ws2s(const std::wstring& s) {
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		return converter.to_bytes(s);
+	}
+#endif
 }
@@ -6,6 +6,7 @@
 #include <strsafe.h>  // StringCchCopy
 #include <windows.h>
 
+#include <algorithm>  // transform
 #include <map>     // window map
 #include <string>  // error string
 
@@ -59,6 +60,30 @@ BOOL AddNotificationIcon(HWND hwnd) {
 	return success;
 }
 
+// receive arrival/removal of hid devices through WM_DEVICECHANGE
+HDEVNOTIFY RegisterHidNotification(HWND hwnd) {
+	// GUID_DEVINTERFACE_HID
+	static const GUID hidInterfaceGuid = { 0x4d1e55b2, 0xf16f, 0x11cf, { 0x88, 0xcb, 0x00, 0x11, 0x11, 0x00, 0x00, 0x30 } };
+
+	DEV_BROADCAST_DEVICEINTERFACE filter = {0};
+	filter.dbcc_size = sizeof(filter);
+	filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+	filter.dbcc_classguid = hidInterfaceGuid;
+	return RegisterDeviceNotification(hwnd, &filter, DEVICE_NOTIFY_WINDOW_HANDLE);
+}
+
+// only react to plug events of ledger devices
+bool IsLedgerDeviceEvent(LPARAM lParam) {
+	PDEV_BROADCAST_HDR header = (PDEV_BROADCAST_HDR)lParam;
+	if (header == nullptr || header->dbch_devicetype != DBT_DEVTYP_DEVICEINTERFACE) {
+		return false;
+	}
+
+	std::wstring path = ((PDEV_BROADCAST_DEVICEINTERFACE)header)->dbcc_name;
+	std::transform(path.begin(), path.end(), path.begin(), ::towlower);
+	return path.find(L"vid_2c97") != std::wstring::npos;
+}
+
 BOOL DeleteNotificationIcon() {
 	NOTIFYICONDATA nid = {sizeof(nid)};
 
@@ -310,16 +335,18 @@ bool SaveIdentity(HWND windowHandle, int index, bool changed) {
 
 	Application* app = Window::GetPtr()->GetApplication();
 	Identity& ident = Window::GetPtr()->GetApplication()->GetIdentityByIndex(index);
+	Identity changed = ident;
 
-	ident.protocol = readDialogItemWStr(windowHandle, IDC_TXT_PROTOCOL);
-	ident.name = readDialogItemWStr(windowHandle, IDC_TXT_DISPLAYNAME);
-	ident.host = readDialogItemWStr(windowHandle, IDC_TXT_HOSTNAME);
-	ident.user = readDialogItemWStr(windowHandle, IDC_TXT_USERNAME);
-	ident.port = readDialogItemNumber(windowHandle, IDC_TXT_PORT);
+	changed.protocol = readDialogItemWStr(windowHandle, IDC_TXT_PROTOCOL);
+	changed.name = readDialogItemWStr(windowHandle, IDC_TXT_DISPLAYNAME);
+	changed.host = readDialogItemWStr(windowHandle, IDC_TXT_HOSTNAME);
+	changed.user = readDialogItemWStr(windowHandle, IDC_TXT_USERNAME);
+	changed.port = readDialogItemNumber(windowHandle, IDC_TXT_PORT);
 
 	int32_t key_type_id = readDialogComboIndex(windowHandle, IDC_CMB_TYPE);
-	ident.keyType = app->GetKeyTypeByIndex(key_type_id);
+	changed.keyType = app->GetKeyTypeByIndex(key_type_id);
 
+	app->UpdateIdentity(ident, changed);
 	return app->SaveIdentity(ident);
 }
 
@@ -332,7 +359,8 @@ Identity& GetSelectedIdentity(HWND listHandle) {
 void GetKeyForSelectedItem(HWND listHandle) {
 	Identity& ident = GetSelectedIdentity(listHandle);
 	Application* app = Window::GetPtr()->GetApplication();
-	ident.pubkey_cached = app->GetPubKeyFor(ident);
+	// the device is asked without the store locked
+	app->SetPubKey(ident, app->GetPubKeyFor(ident));
 	RefreshIdentityList(listHandle, 0);
 }
 
@@ -563,7 +591,7 @@ BOOL CALLBACK ManageIdentProc(HWND hwnd, UINT Message, WPARAM wParam,
 		case ID__CLEARPUBLICKEY:
 		{
 			Identity& ident = GetSelectedIdentity(m_hListBox);
-			ident.pubkey_cached = ByteArray();
+			Window::GetPtr()->GetApplication()->SetPubKey(ident, ByteArray());
 			RefreshIdentityList(m_hListBox, 0);
 		} break;
 		}
@@ -605,6 +633,7 @@ LRESULT CALLBACK NotificationIconCallback(HWND hwnd, unsigned int message,
 		if (!AddNotificationIcon(hwnd)) {
 			return -1;
 		}
+		RegisterHidNotification(hwnd);
 		break;
 	case WM_COMMAND:
 	{
@@ -634,29 +663,29 @@ LRESULT CALLBACK NotificationIconCallback(HWND hwnd, unsigned int message,
 		}
 	} break;
 
-	/*
-			TODO: handle ledger detection/removal
 	case WM_DEVICECHANGE:
 	{
-			switch (wParam)
-			{
-			case DBT_DEVICEARRIVAL:
-					// added device, could've been ledger
-					LOG_DBG("device arrival");
-					break;
-			case DBT_DEVICEREMOVECOMPLETE:
-					// removed device, could've been ledger
-					LOG_DBG("device removal");
-					break;
-			case DBT_DEVNODES_CHANGED:
-					// device updated, could've been ledger?
-					LOG_DBG("device changed");
-					break;
-			default:
-					break;
-			};
+		if (!IsLedgerDeviceEvent(lParam)) {
+			break;
+		}
+
+		Application* app = Window::GetPtr()->GetApplication();
+		switch (wParam) {
+		case DBT_DEVICEARRIVAL:
+			// added device, could've been ledger
+			LOG_DBG("device arrival");
+			app->OnDeviceArrival();
+			break;
+		case DBT_DEVICEREMOVECOMPLETE:
+			// removed device, could've been ledger
+			LOG_DBG("device removal");
+			app->OnDeviceRemoval();
+			break;
+		default:
+			break;
+		};
 	}
-	break;*/
+	break;
 
 	case WMAPP_NOTIFYCALLBACK:
 		switch (LOWORD(lParam)) {
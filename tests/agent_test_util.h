@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "agent_core.h"
+#include "ssh_wire.h"
+
+// Identity store kept in memory, for agents tested without the registry.
+class IdentityList : public IdentityStore {
+public:
+	size_t GetNumIdentities() const override {
+		return mIdentities.size();
+	}
+
+	const Identity& GetIdentityByIndex(size_t index) const override {
+		return mIdentities[index];
+	}
+
+	uint64_t GetGeneration() const override {
+		return mGeneration;
+	}
+
+	// address with a made up key, no device is asked for it
+	void Add(const std::string& address, const std::vector<uint8_t>& keyBlob) {
+		Identity ident(address);
+		ident.name = L"identity";
+		ident.pubkey_cached.Get() = keyBlob;
+		mIdentities.push_back(ident);
+		mGeneration++;
+	}
+
+	std::vector<Identity> mIdentities;
+	uint64_t mGeneration = 0;
+};
+
+// framed agent request, body writes what follows the message type
+static inline std::vector<uint8_t> MakeRequest(uint8_t type, const std::function<void(SshWriter&)>& body = nullptr) {
+	std::vector<uint8_t> request;
+	SshWriter writer(request);
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte(type);
+	if (body) {
+		body(writer);
+	}
+	writer.EndLength(messageStart);
+	return request;
+}
+
+// message type of a framed response, 0 when there is none
+static inline uint8_t ResponseType(const SharedResponse& response) {
+	return response && response->size() > 4 ? (*response)[4] : 0;
+}
+
+// key blobs of a framed SSH2_AGENT_IDENTITIES_ANSWER, in offer order
+static inline std::vector<std::vector<uint8_t>> ParseKeys(const SharedResponse& response) {
+	std::vector<std::vector<uint8_t>> keys;
+	if (ResponseType(response) != SSH2_AGENT_IDENTITIES_ANSWER) {
+		return keys;
+	}
+
+	SshReader reader(response->data() + 5, response->size() - 5);
+	uint32_t numKeys = 0;
+	reader.ReadUint32(numKeys);
+	for (uint32_t i = 0; i < numKeys; ++i) {
+		ByteSpan key;
+		ByteSpan comment;
+		if (!reader.ReadString(key) || !reader.ReadString(comment)) {
+			break;
+		}
+		keys.push_back(std::vector<uint8_t>(key.data, key.data + key.size));
+	}
+
+	return keys;
+}
+
+// keys offered to client
+static inline std::vector<std::vector<uint8_t>> ListKeys(AgentCore& agent, AgentClient& client) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_REQUEST_IDENTITIES);
+	SharedResponse response;
+	agent.HandleFastRequest(client, request.data(), request.size(), response);
+	return ParseKeys(response);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstring>
+#include <vector>
+
+#include "hid_backend.h"
+#include "hid_framing.h"
+
+// HID device that answers every command with the command itself followed by
+// status 0x9000, framed the way the Ledger does. Its buffers are set up
+// front, so exchanging with it does not allocate.
+class LoopbackBackend : public HidBackend {
+public:
+	explicit LoopbackBackend(size_t maxPayload = shortPayloadMax)
+		: mMaxPayload(maxPayload) {
+		mResponse.reserve(0x10000);
+	}
+
+	bool Open() override {
+		mOpen = true;
+		return true;
+	}
+
+	void Close() override {
+		mOpen = false;
+	}
+
+	bool IsOpen() const override {
+		return mOpen;
+	}
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override {
+		if (!mFramer.Next()) {
+			return 0;
+		}
+
+		// without the report id, as hidapi reads it
+		const size_t size = length < packet_size ? length : packet_size;
+		memcpy(data, mFramer.Report() + 1, size);
+		return (int)size;
+	}
+
+	int Write(const uint8_t* data, size_t length) override {
+		if (length < 1) {
+			return -1;
+		}
+
+		if (mCommand.Feed(data + 1, length - 1) == ApduReassembler::State::Incomplete) {
+			return (int)length;
+		}
+
+		if (mCommand.MessageSize() == 0) {
+			mCommand.Reset();
+			return -1;
+		}
+
+		mResponse.resize(mCommand.MessageSize() + 2);
+		memcpy(mResponse.data(), mCommand.Data(), mCommand.MessageSize());
+		mResponse[mCommand.MessageSize()] = 0x90;
+		mResponse[mCommand.MessageSize() + 1] = 0x00;
+		mFramer.Begin(mResponse.data(), mResponse.size());
+		mCommand.Reset();
+		return (int)length;
+	}
+
+	size_t GetMaxPayload() const override {
+		return mMaxPayload;
+	}
+
+private:
+	bool mOpen = false;
+	size_t mMaxPayload;
+	ApduReassembler mCommand;
+	ApduFramer mFramer;
+	std::vector<uint8_t> mResponse;
+};
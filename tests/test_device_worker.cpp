@@ -0,0 +1,139 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "apdu_status.h"
+#include "device_pool.h"
+#include "device_worker.h"
+#include "emulated_device.h"
+#include "test_util.h"
+
+// DeviceWorker probes for the app once per session, again after another app
+// answered with 0x6e00, and reconnects after the device was unplugged. A
+// request is not sent while the probe fails.
+
+struct DeviceCounts {
+	std::atomic<int> opens{ 0 };
+	std::atomic<int> probes{ 0 };
+	std::atomic<int> commands{ 0 };
+	std::atomic<bool> failProbes{ false };
+};
+
+// passes reports through to the emulator, counting opens and commands
+class CountingBackend : public HidBackend {
+public:
+	CountingBackend(DeviceCounts& counts)
+		: mCounts(counts)
+		, mDevice(new EmulatedDevice()) {
+	}
+
+	bool Open() override {
+		mCounts.opens++;
+		return mDevice->Open();
+	}
+
+	void Close() override {
+		mDevice->Close();
+	}
+
+	bool IsOpen() const override {
+		return mDevice->IsOpen();
+	}
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override {
+		return mDevice->Read(data, length, timeoutMs);
+	}
+
+	int Write(const uint8_t* data, size_t length) override {
+		// report id(1) channel(2) tag(1) sequence(2) length(2) cla ins
+		const bool first = length > 9 && data[4] == 0 && data[5] == 0;
+		if (first && data[8] == 0xB0 && data[9] == 0x01) {
+			mCounts.probes++;
+			if (mCounts.failProbes) {
+				// answered with an error instead of the app name
+				std::vector<uint8_t> report(data, data + length);
+				report[8] = 0x80;
+				report[9] = 0x04;
+				return mDevice->Write(report.data(), report.size());
+			}
+		}
+		else if (first) {
+			mCounts.commands++;
+		}
+
+		return mDevice->Write(data, length);
+	}
+
+	size_t GetMaxPayload() const override {
+		return mDevice->GetMaxPayload();
+	}
+
+private:
+	DeviceCounts& mCounts;
+	std::unique_ptr<EmulatedDevice> mDevice;
+};
+
+// an app command the emulator answers without asking the user
+static uint16_t Send(DeviceWorker& worker, uint8_t cla = 0x80) {
+	DeviceWorker::Response response = worker.Exchange(APDU(cla, 0x02, 0x00, 0x00, ByteArray())).get();
+	return response.valid ? response.statusCode : 0;
+}
+
+int main() {
+	DeviceCounts counts;
+	DeviceWorker worker{ std::unique_ptr<HidBackend>(new CountingBackend(counts)) };
+
+	// one open and one probe for the session
+	for (int i = 0; i < 3; ++i) {
+		CHECK(Send(worker) != 0);
+	}
+	CHECK(counts.opens == 1);
+	CHECK(counts.probes == 1);
+	CHECK(counts.commands == 3);
+
+	// another app answers, the next request probes again
+	CHECK(Send(worker, 0xE0) == CODE_CLA_NOT_SUPPORTED);
+	CHECK(counts.probes == 1);
+	CHECK(Send(worker) != 0);
+	CHECK(counts.probes == 2);
+	CHECK(Send(worker) != 0);
+	CHECK(counts.probes == 2);
+
+	// unplugged and plugged in again, the arrival reconnects ahead of the request
+	worker.OnDeviceRemoval();
+	worker.OnDeviceArrival();
+	CHECK(Send(worker) != 0);
+	CHECK(counts.opens == 2);
+	CHECK(counts.probes == 3);
+
+	// unplugged with the request already queued, it reconnects itself
+	worker.OnDeviceRemoval();
+	CHECK(Send(worker) != 0);
+	CHECK(counts.opens == 3);
+	CHECK(counts.probes == 4);
+	const int commands = counts.commands;
+
+	// a failing probe keeps the request from being sent
+	worker.OnDeviceRemoval();
+	counts.failProbes = true;
+	CHECK(Send(worker) == 0);
+	CHECK(counts.commands == commands);
+
+	counts.failProbes = false;
+	CHECK(Send(worker) != 0);
+	CHECK(counts.commands == commands + 1);
+
+	worker.Stop();
+
+	// the pool tells its listener the count at once and on every attach
+	DevicePool devices;
+	std::vector<size_t> numDevices;
+	devices.SetDevicesChanged([&numDevices](size_t count) {
+		numDevices.push_back(count);
+	});
+	devices.Attach(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+	devices.Attach(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+	CHECK(numDevices == std::vector<size_t>({ 0, 1, 2 }));
+
+	return TestResult();
+}
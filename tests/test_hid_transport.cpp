@@ -0,0 +1,64 @@
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "hid_transport.h"
+#include "loopback_backend.h"
+#include "test_util.h"
+
+// HidTransport frames commands and reassembles responses of any length, and
+// once a response buffer is sized an exchange makes no heap allocation.
+
+constexpr size_t numExchanges = 1000;
+
+static bool IsEcho(const APDU& apdu, const ApduResponse& response) {
+	if (!response.valid || response.statusCode != 0x9000 || response.data.Size() != apdu.SerializedSize()) {
+		return false;
+	}
+
+	std::vector<uint8_t> expected(apdu.SerializedSize());
+	apdu.CopyTo(0, expected.data(), expected.size());
+	return memcmp(response.data.Get().data(), expected.data(), expected.size()) == 0;
+}
+
+int main() {
+	HidTransport transport{ std::unique_ptr<HidBackend>(new LoopbackBackend(extendedPayloadMax)) };
+	CHECK(transport.Open());
+
+	// single report, report boundaries, short and extended commands
+	const size_t payloadSizes[] = { 0, 1, 52, 53, 54, 116, 117, 255, 256, 1000, 4096, extendedPayloadMax - 2 };
+	ApduResponse response;
+	for (size_t payloadSize : payloadSizes) {
+		std::vector<uint8_t> payload(payloadSize);
+		for (size_t i = 0; i < payloadSize; ++i) {
+			payload[i] = (uint8_t)(i * 7 + payloadSize);
+		}
+
+		APDU apdu(0x80, 0x04, 0x00, 0x00, payload.data(), payload.size());
+		CHECK(transport.Exchange(apdu, response));
+		CHECK(IsEcho(apdu, response));
+	}
+
+	// steady state: the response buffer already holds the largest answer
+	std::vector<uint8_t> payload(4096, 0xa5);
+	APDU apdu(0x80, 0x04, 0x01, 0x00, payload.data(), payload.size());
+	CHECK(transport.Exchange(apdu, response));
+
+	const size_t allocations = AllocationCount();
+	for (size_t i = 0; i < numExchanges; ++i) {
+		if (!transport.Exchange(apdu, response)) {
+			CHECK(!"exchange failed");
+			break;
+		}
+	}
+	CHECK(AllocationCount() == allocations);
+	CHECK(IsEcho(apdu, response));
+
+	// a closed device answers nothing and leaves the response invalid
+	transport.Close();
+	CHECK(!transport.Exchange(apdu, response));
+	CHECK(!response.valid && response.data.Empty());
+
+	return TestResult();
+}
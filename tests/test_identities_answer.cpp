@@ -0,0 +1,184 @@
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "agent_core.h"
+#include "agent_socket_server.h"
+#include "test_util.h"
+
+// Key listing with 10k loaded identities: the answer is built once, shared
+// between requests, and streamed whole to clients pipelining listings.
+
+constexpr size_t numIdentities = 10000;
+constexpr size_t keyBlobSize = 104;
+constexpr size_t numClients = 8;
+constexpr size_t listingsPerClient = 3;
+
+class IdentityList : public IdentityStore {
+public:
+	size_t GetNumIdentities() const override {
+		return mIdentities.size();
+	}
+
+	const Identity& GetIdentityByIndex(size_t index) const override {
+		return mIdentities[index];
+	}
+
+	uint64_t GetGeneration() const override {
+		return mIdentities.size();
+	}
+
+	std::vector<Identity> mIdentities;
+};
+
+// distinct key blob per index, no device is asked for it
+static std::vector<uint8_t> MakeKeyBlob(size_t index) {
+	std::vector<uint8_t> blob(keyBlobSize, (uint8_t)index);
+	blob[0] = (uint8_t)(index >> 8);
+	blob[1] = (uint8_t)(index >> 16);
+	return blob;
+}
+
+static void CheckAnswer(const IdentityList& identities, const SharedResponse& answer) {
+	CHECK(answer != nullptr);
+	if (answer == nullptr) {
+		return;
+	}
+
+	SshReader reader(answer->data(), answer->size());
+	uint32_t length = 0;
+	uint8_t type = 0;
+	uint32_t numKeys = 0;
+	CHECK(reader.ReadUint32(length) && length == answer->size() - 4);
+	CHECK(reader.ReadByte(type) && type == SSH2_AGENT_IDENTITIES_ANSWER);
+	CHECK(reader.ReadUint32(numKeys) && numKeys == numIdentities);
+
+	for (size_t i = 0; i < numKeys; ++i) {
+		ByteSpan key;
+		ByteSpan comment;
+		if (!reader.ReadString(key) || !reader.ReadString(comment)) {
+			CHECK(!"answer truncated");
+			return;
+		}
+
+		// never used, so offered in store order
+		const std::vector<uint8_t> expectedKey = MakeKeyBlob(i);
+		const std::string expectedComment = identities.mIdentities[i].ToString();
+		CHECK(key.size == expectedKey.size() && memcmp(key.data, expectedKey.data(), key.size) == 0);
+		CHECK(comment.size == expectedComment.size() && memcmp(comment.data, expectedComment.data(), comment.size) == 0);
+	}
+}
+
+#ifdef __linux__
+// every client sends its listings at once, then reads all the answers back
+static void CheckSocketClients(const std::string& path, const SharedResponse& answer) {
+	const uint8_t request[] = { 0, 0, 0, 1, SSH2_AGENTC_REQUEST_IDENTITIES };
+
+	std::vector<std::thread> clients;
+	std::vector<int> results(numClients, 0);
+	for (size_t c = 0; c < numClients; ++c) {
+		clients.emplace_back([&, c]() {
+			int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			sockaddr_un address = {};
+			address.sun_family = AF_UNIX;
+			strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+			if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+				close(fd);
+				return;
+			}
+
+			for (size_t i = 0; i < listingsPerClient; ++i) {
+				send(fd, request, sizeof(request), MSG_NOSIGNAL);
+			}
+
+			std::vector<uint8_t> received;
+			std::vector<uint8_t> buffer(64 * 1024);
+			while (received.size() < listingsPerClient * answer->size()) {
+				ssize_t count = recv(fd, buffer.data(), buffer.size(), 0);
+				if (count <= 0) {
+					break;
+				}
+				received.insert(received.end(), buffer.begin(), buffer.begin() + count);
+			}
+			close(fd);
+
+			bool same = received.size() == listingsPerClient * answer->size();
+			for (size_t i = 0; same && i < listingsPerClient; ++i) {
+				same = memcmp(received.data() + i * answer->size(), answer->data(), answer->size()) == 0;
+			}
+			results[c] = same ? 1 : 0;
+		});
+	}
+
+	for (std::thread& client : clients) {
+		client.join();
+	}
+
+	for (int result : results) {
+		CHECK(result == 1);
+	}
+}
+#endif
+
+int main() {
+	IdentityList identities;
+	for (size_t i = 0; i < numIdentities; ++i) {
+		Identity ident("ssh://user" + std::to_string(i) + "@host-" + std::to_string(i) + ".example.com:22");
+		ident.name = L"identity";
+		std::vector<uint8_t> blob = MakeKeyBlob(i);
+		ident.pubkey_cached.PushBack(blob.data(), (uint32_t)blob.size());
+		identities.mIdentities.push_back(ident);
+	}
+
+	DevicePool devices;
+	AgentCore agent(devices, identities);
+	const uint8_t request[] = { 0, 0, 0, 1, SSH2_AGENTC_REQUEST_IDENTITIES };
+	AgentClient client;
+
+	// the first request builds the answer
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	SharedResponse first;
+	CHECK(agent.HandleFastRequest(client, request, sizeof(request), first));
+	std::chrono::duration<double, std::micro> built = std::chrono::steady_clock::now() - start;
+	CheckAnswer(identities, first);
+	CHECK(agent.GetNumLoadedKeys() == numIdentities);
+
+	// later listings are the same buffer, not a copy
+	start = std::chrono::steady_clock::now();
+	SharedResponse second;
+	CHECK(agent.HandleFastRequest(client, request, sizeof(request), second));
+	std::chrono::duration<double, std::micro> cached = std::chrono::steady_clock::now() - start;
+	CHECK(first == second);
+
+	if (first != nullptr) {
+		printf("%u identities: %u byte answer, built in %.0f us, served again in %.1f us\n",
+			(unsigned)numIdentities, (unsigned)first->size(), built.count(), cached.count());
+	}
+
+#ifdef __linux__
+	if (first != nullptr) {
+		const std::string path = "/tmp/test_identities_answer." + std::to_string(getpid());
+		AgentSocketServer server(agent, path);
+		CHECK(server.Listen());
+		std::thread serverThread([&server]() {
+			server.Run();
+		});
+
+		CheckSocketClients(path, first);
+
+		server.Stop();
+		serverThread.join();
+		unlink(path.c_str());
+	}
+#endif
+
+	return TestResult();
+}
@@ -0,0 +1,91 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "agent_core.h"
+#include "agent_test_util.h"
+#include "emulated_device.h"
+#include "test_util.h"
+
+// Keys that signed more are offered first. A success that moves a key makes
+// the next listing a new answer; one that leaves the order as it was keeps
+// serving the same buffer.
+
+static bool Sign(AgentCore& agent, const std::vector<uint8_t>& keyBlob, const std::vector<uint8_t>& hostKey = std::vector<uint8_t>()) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_SIGN_REQUEST, [&](SshWriter& writer) {
+		writer.WriteString(keyBlob.data(), keyBlob.size());
+		writer.WriteString("challenge to sign");
+		writer.WriteUint32(0);
+	});
+
+	AgentClient client;
+	client.boundHostKey = hostKey;
+	SharedResponse response;
+	agent.HandleRequest(client, request.data(), request.size(), response);
+	return ResponseType(response) == SSH2_AGENT_SIGN_RESPONSE;
+}
+
+static SharedResponse List(AgentCore& agent, AgentClient& client) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_REQUEST_IDENTITIES);
+	SharedResponse response;
+	agent.HandleFastRequest(client, request.data(), request.size(), response);
+	return response;
+}
+
+int main() {
+	IdentityList identities;
+	DevicePool devices;
+	devices.Attach(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+	AgentCore agent(devices, identities);
+
+	const char* addresses[] = { "ssh://alice@a.example.com", "ssh://bob@b.example.com", "ssh://carol@c.example.com" };
+	std::vector<std::vector<uint8_t>> keys;
+	for (const char* address : addresses) {
+		Identity ident(address);
+		ident.InitKeyType("nistp256");
+		uint16_t status = 0;
+		keys.push_back(agent.FetchPublicKey(ident, &status).Get());
+		CHECK(!keys.back().empty());
+		identities.Add(address, keys.back());
+		identities.mIdentities.back().keyType = ident.keyType;
+	}
+	const std::vector<uint8_t>& keyA = keys[0];
+	const std::vector<uint8_t>& keyB = keys[1];
+	const std::vector<uint8_t>& keyC = keys[2];
+
+	AgentClient client;
+	SharedResponse first = List(agent, client);
+	CHECK(ParseKeys(first) == std::vector<std::vector<uint8_t>>({ keyA, keyB, keyC }));
+
+	// carol moves to the front
+	CHECK(Sign(agent, keyC));
+	SharedResponse second = List(agent, client);
+	CHECK(second != first);
+	CHECK(ParseKeys(second) == std::vector<std::vector<uint8_t>>({ keyC, keyA, keyB }));
+
+	// already in front, nothing is rebuilt
+	CHECK(Sign(agent, keyC));
+	CHECK(List(agent, client) == second);
+
+	// bob passes alice but not carol, who signed twice
+	CHECK(Sign(agent, keyB));
+	SharedResponse third = List(agent, client);
+	CHECK(ParseKeys(third) == std::vector<std::vector<uint8_t>>({ keyC, keyB, keyA }));
+
+	// a host alice signed for gets her first; she also passes bob
+	const std::vector<uint8_t> hostKey = { 'h', 'o', 's', 't' };
+	AgentClient bound;
+	bound.boundHostKey = hostKey;
+	CHECK(ParseKeys(List(agent, bound)) == ParseKeys(third));
+	CHECK(Sign(agent, keyA, hostKey));
+	CHECK(ParseKeys(List(agent, bound)) == std::vector<std::vector<uint8_t>>({ keyA, keyC, keyB }));
+	SharedResponse fourth = List(agent, client);
+	CHECK(ParseKeys(fourth) == std::vector<std::vector<uint8_t>>({ keyC, keyA, keyB }));
+
+	// carol stays in front overall, the host's own order still changes
+	CHECK(Sign(agent, keyC, hostKey));
+	CHECK(List(agent, client) == fourth);
+	CHECK(ParseKeys(List(agent, bound)) == std::vector<std::vector<uint8_t>>({ keyC, keyA, keyB }));
+
+	return TestResult();
+}
@@ -0,0 +1,98 @@
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "ledger_device.h"
+#include "test_util.h"
+
+// Device reads HID reports into its preallocated ring: no read allocates,
+// and a view stays valid until reportRingSlots more reads.
+
+constexpr size_t numReads = 10000;
+
+// answers every read with a report numbered by the read, without allocating
+class FakeBackend : public HidBackend {
+public:
+	bool Open() override {
+		mOpen = true;
+		return true;
+	}
+
+	void Close() override {
+		mOpen = false;
+	}
+
+	bool IsOpen() const override {
+		return mOpen;
+	}
+
+	int Read(uint8_t* data, size_t length, int timeoutMs) override {
+		if (failReads) {
+			return -1;
+		}
+
+		memset(data, 0, length);
+		data[0] = (uint8_t)(reads >> 8);
+		data[1] = (uint8_t)reads;
+		reads++;
+		return (int)length;
+	}
+
+	int Write(const uint8_t* data, size_t length) override {
+		writes++;
+		return (int)length;
+	}
+
+	size_t reads = 0;
+	size_t writes = 0;
+	bool failReads = false;
+
+private:
+	bool mOpen = false;
+};
+
+int main() {
+	FakeBackend* backend = new FakeBackend();
+	Device device{ std::unique_ptr<HidBackend>(backend) };
+	CHECK(device.Open());
+
+	// a view points into the ring and survives the next reportRingSlots - 1 reads
+	ReportView views[reportRingSlots];
+	for (size_t i = 0; i < reportRingSlots; ++i) {
+		CHECK(device.Read(views[i], 1000));
+		CHECK(views[i].size == packet_size);
+	}
+	for (size_t i = 0; i < reportRingSlots; ++i) {
+		CHECK(views[i].data[0] == 0 && views[i].data[1] == i);
+		for (size_t j = 0; j < i; ++j) {
+			CHECK(views[i].data != views[j].data);
+		}
+	}
+
+	ReportView reused;
+	CHECK(device.Read(reused, 1000));
+	CHECK(reused.data == views[0].data);
+
+	// steady state reads do not touch the heap
+	const size_t allocations = AllocationCount();
+	size_t bytes = 0;
+	for (size_t i = 0; i < numReads; ++i) {
+		ReportView report;
+		if (!device.Read(report, 1000)) {
+			CHECK(!"read failed");
+			break;
+		}
+		bytes += report.size;
+	}
+	CHECK(AllocationCount() == allocations);
+	CHECK(bytes == numReads * packet_size);
+
+	// a failed read closes the device so it is reopened on next use
+	backend->failReads = true;
+	ReportView failed;
+	CHECK(!device.Read(failed, 1000));
+	CHECK(!device.IsOpen());
+
+	return TestResult();
+}
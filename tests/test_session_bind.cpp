@@ -0,0 +1,102 @@
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "agent_core.h"
+#include "agent_test_util.h"
+#include "encodeUtil.h"
+#include "known_hosts.h"
+#include "test_util.h"
+
+// A client bound with session-bind@openssh.com is offered the identities of
+// the host it authenticates to, found through known_hosts, and every key when
+// the host is unknown. A connection is bound once unless it forwards.
+
+static std::vector<uint8_t> MakeBlob(const std::string& text) {
+	return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+static SharedResponse Bind(AgentCore& agent, AgentClient& client, const std::vector<uint8_t>& hostKey, bool forwarding) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_EXTENSION, [&](SshWriter& writer) {
+		writer.WriteString("session-bind@openssh.com");
+		writer.WriteString(hostKey.data(), hostKey.size());
+		writer.WriteString("session id");
+		writer.WriteString("signature");
+		writer.WriteByte(forwarding ? 1 : 0);
+	});
+
+	SharedResponse response;
+	agent.HandleFastRequest(client, request.data(), request.size(), response);
+	return response;
+}
+
+int main() {
+	const std::vector<uint8_t> keyA = MakeBlob("key of alice");
+	const std::vector<uint8_t> keyB = MakeBlob("key of bob");
+	const std::vector<uint8_t> keyC = MakeBlob("key of carol");
+	const std::vector<uint8_t> hostA = MakeBlob("host key a");
+	const std::vector<uint8_t> hostB = MakeBlob("host key b");
+	const std::vector<uint8_t> hostUnknown = MakeBlob("host key elsewhere");
+
+	IdentityList identities;
+	identities.Add("ssh://alice@a.example.com", keyA);
+	identities.Add("ssh://bob@b.example.com:2222", keyB);
+	identities.Add("ssh://carol@c.example.com", keyC);
+
+	// off port 22 the host is written [host]:port
+	const std::string path = "test_session_bind.known_hosts." + std::to_string(getpid());
+	{
+		std::ofstream file(path);
+		file << "# comment\n";
+		file << "a.example.com ssh-ed25519 " << encodeUtils::encodeBase64(std::string(hostA.begin(), hostA.end())) << "\n";
+		file << "[b.example.com]:2222 ssh-ed25519 " << encodeUtils::encodeBase64(std::string(hostB.begin(), hostB.end())) << "\n";
+	}
+	std::shared_ptr<KnownHosts> knownHosts = std::make_shared<KnownHosts>();
+	CHECK(knownHosts->Load(path));
+	unlink(path.c_str());
+	CHECK(knownHosts->GetNumKeys() == 2);
+
+	DevicePool devices;
+	AgentCore agent(devices, identities);
+	agent.SetKnownHosts(knownHosts);
+	const std::vector<std::vector<uint8_t>> all = { keyA, keyB, keyC };
+
+	AgentClient unbound;
+	CHECK(ListKeys(agent, unbound) == all);
+
+	AgentClient clientA;
+	CHECK(ResponseType(Bind(agent, clientA, hostA, false)) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, clientA) == std::vector<std::vector<uint8_t>>({ keyA }));
+
+	AgentClient clientB;
+	CHECK(ResponseType(Bind(agent, clientB, hostB, false)) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, clientB) == std::vector<std::vector<uint8_t>>({ keyB }));
+
+	// an unknown host gets every key, as without the binding
+	AgentClient clientElsewhere;
+	CHECK(ResponseType(Bind(agent, clientElsewhere, hostUnknown, false)) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, clientElsewhere) == all);
+
+	// the scoped listings do not leak into each other or the unbound one
+	CHECK(ListKeys(agent, clientA) == std::vector<std::vector<uint8_t>>({ keyA }));
+	CHECK(ListKeys(agent, unbound) == all);
+
+	// a connection used for authentication is not bound again
+	CHECK(ResponseType(Bind(agent, clientA, hostB, false)) == SSH_AGENT_FAILURE);
+	CHECK(ListKeys(agent, clientA) == std::vector<std::vector<uint8_t>>({ keyA }));
+
+	// a forwarded one moves on to the next hop
+	AgentClient forwarded;
+	CHECK(ResponseType(Bind(agent, forwarded, hostA, true)) == SSH_AGENT_SUCCESS);
+	CHECK(ResponseType(Bind(agent, forwarded, hostB, true)) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, forwarded) == std::vector<std::vector<uint8_t>>({ keyB }));
+
+	// without known hosts the binding narrows nothing
+	agent.SetKnownHosts(std::make_shared<KnownHosts>());
+	CHECK(ListKeys(agent, clientA) == all);
+
+	return TestResult();
+}
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sign_scheduler.h"
+#include "test_util.h"
+
+// SignScheduler serves clients round-robin, refuses jobs past its queue bounds
+// and drops cancelled or expired jobs without running them. A blocking job
+// holds the single device slot while the others queue.
+
+// holds a job on the scheduler thread until opened
+class Gate {
+public:
+	void Wait() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mEntered = true;
+		mCondition.notify_all();
+		mCondition.wait(lock, [this]() { return mOpen; });
+	}
+
+	void WaitEntered() {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait(lock, [this]() { return mEntered; });
+	}
+
+	void Open() {
+		std::lock_guard<std::mutex> lock(mMutex);
+		mOpen = true;
+		mCondition.notify_all();
+	}
+
+private:
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	bool mEntered = false;
+	bool mOpen = false;
+};
+
+// names of the jobs in the order they were called, with how
+class Log {
+public:
+	SignScheduler::Job Job(const std::string& name) {
+		return [this, name](bool cancelled) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mEntries.push_back(cancelled ? name + " cancelled" : name);
+			mCondition.notify_all();
+		};
+	}
+
+	std::vector<std::string> WaitFor(size_t count) {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait_for(lock, std::chrono::seconds(10), [this, count]() { return mEntries.size() >= count; });
+		return mEntries;
+	}
+
+private:
+	std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::vector<std::string> mEntries;
+};
+
+// occupies the only slot of scheduler until gate opens
+static void Block(SignScheduler& scheduler, Gate& gate) {
+	CHECK(scheduler.Submit(0, [&gate](bool cancelled) { gate.Wait(); }));
+	gate.WaitEntered();
+}
+
+static void TestRoundRobin() {
+	SignScheduler scheduler;
+	scheduler.SetConcurrency(1);
+	Gate gate;
+	Log log;
+	Block(scheduler, gate);
+
+	// a batch client queues three jobs before the other client's two
+	CHECK(scheduler.Submit(1, log.Job("a1")));
+	CHECK(scheduler.Submit(1, log.Job("a2")));
+	CHECK(scheduler.Submit(1, log.Job("a3")));
+	CHECK(scheduler.Submit(2, log.Job("b1")));
+	CHECK(scheduler.Submit(2, log.Job("b2")));
+	CHECK(scheduler.GetStats().queued == 5);
+	CHECK(scheduler.GetStats().clients == 2);
+
+	gate.Open();
+	const std::vector<std::string> expected = { "a1", "b1", "a2", "b2", "a3" };
+	CHECK(log.WaitFor(expected.size()) == expected);
+}
+
+static void TestBounds() {
+	Log log;
+	{
+		SignScheduler scheduler(3, 2);
+		scheduler.SetConcurrency(1);
+		Gate gate;
+		Block(scheduler, gate);
+
+		// per client bound
+		CHECK(scheduler.Submit(1, log.Job("a1")));
+		CHECK(scheduler.Submit(1, log.Job("a2")));
+		CHECK(!scheduler.Submit(1, log.Job("a3")));
+
+		// global bound, also over a larger bound for the client
+		CHECK(scheduler.Submit(2, log.Job("b1")));
+		CHECK(!scheduler.Submit(2, log.Job("b2")));
+		CHECK(!scheduler.Submit(3, log.Job("c1"), CancelFlag(), 8));
+
+		SignScheduler::Stats stats = scheduler.GetStats();
+		CHECK(stats.queued == 3);
+		CHECK(stats.rejected == 3);
+
+		gate.Open();
+		log.WaitFor(3);
+	}
+
+	// refused jobs are never called, not even when the scheduler goes away
+	const std::vector<std::string> expected = { "a1", "b1", "a2" };
+	CHECK(log.WaitFor(expected.size()) == expected);
+}
+
+static void TestDropped() {
+	SignScheduler scheduler;
+	scheduler.SetConcurrency(1);
+	scheduler.SetMaxWait(std::chrono::milliseconds(50));
+	Gate gate;
+	Log log;
+	Block(scheduler, gate);
+
+	// the client of the first goes away, the second waits past the deadline
+	CancelFlag cancel = MakeCancelFlag();
+	CHECK(scheduler.Submit(1, log.Job("gone"), cancel));
+	CHECK(scheduler.Submit(2, log.Job("expired")));
+	cancel->store(true);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(scheduler.Submit(3, log.Job("served")));
+
+	gate.Open();
+	const std::vector<std::string> expected = { "gone cancelled", "expired cancelled", "served" };
+	CHECK(log.WaitFor(expected.size()) == expected);
+	CHECK(scheduler.GetStats().cancelled == 2);
+}
+
+static void TestDroppedMakeRoom() {
+	SignScheduler scheduler(2, 1);
+	scheduler.SetConcurrency(1);
+	Gate gate;
+	Log log;
+	Block(scheduler, gate);
+
+	// a full queue of cancelled jobs does not refuse new ones
+	CancelFlag cancel = MakeCancelFlag();
+	CHECK(scheduler.Submit(1, log.Job("a1"), cancel));
+	CHECK(scheduler.Submit(2, log.Job("b1"), cancel));
+	cancel->store(true);
+	CHECK(scheduler.Submit(1, log.Job("a2")));
+
+	// dropped at once, in no particular order
+	std::vector<std::string> dropped = log.WaitFor(2);
+	std::sort(dropped.begin(), dropped.end());
+	CHECK(dropped == std::vector<std::string>({ "a1 cancelled", "b1 cancelled" }));
+
+	gate.Open();
+	const std::vector<std::string> entries = log.WaitFor(3);
+	CHECK(entries.size() == 3 && entries[2] == "a2");
+	CHECK(scheduler.GetStats().rejected == 0);
+}
+
+int main() {
+	TestRoundRobin();
+	TestBounds();
+	TestDropped();
+	TestDroppedMakeRoom();
+	return TestResult();
+}
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cryptopp/xed25519.h>
+
+#include "agent_core.h"
+#include "agent_test_util.h"
+#include "test_util.h"
+
+// Keys added by clients are listed after the device identities, sign from any
+// number of threads without a device, and stop signing once removed.
+
+constexpr size_t numThreads = 4;
+constexpr size_t signsPerThread = 25;
+
+static std::vector<uint8_t> MakeAddRequest(const uint8_t* seed, const uint8_t* publicKey, const std::string& comment) {
+	return MakeRequest(SSH2_AGENTC_ADD_IDENTITY, [&](SshWriter& writer) {
+		// string public key, string seed and public key, string comment
+		std::vector<uint8_t> privateKey(seed, seed + 32);
+		privateKey.insert(privateKey.end(), publicKey, publicKey + 32);
+		writer.WriteString("ssh-ed25519");
+		writer.WriteString(publicKey, 32);
+		writer.WriteString(privateKey.data(), privateKey.size());
+		writer.WriteString(comment);
+	});
+}
+
+static uint8_t Send(AgentCore& agent, AgentClient& client, const std::vector<uint8_t>& request, SharedResponse& response) {
+	agent.HandleRequest(client, request.data(), request.size(), response);
+	return ResponseType(response);
+}
+
+// signs data with keyBlob and checks the Ed25519 signature against publicKey
+static bool SignsWith(AgentCore& agent, const std::vector<uint8_t>& keyBlob, const uint8_t* publicKey, const std::string& data) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_SIGN_REQUEST, [&](SshWriter& writer) {
+		writer.WriteString(keyBlob.data(), keyBlob.size());
+		writer.WriteString(data);
+		writer.WriteUint32(0);
+	});
+
+	AgentClient client;
+	SharedResponse response;
+	if (Send(agent, client, request, response) != SSH2_AGENT_SIGN_RESPONSE) {
+		return false;
+	}
+
+	// string signature blob: string key type, string signature
+	SshReader reader(response->data() + 5, response->size() - 5);
+	ByteSpan blob;
+	ByteSpan keyType;
+	ByteSpan signature;
+	if (!reader.ReadString(blob)) {
+		return false;
+	}
+	SshReader blobReader(blob.data, blob.size);
+	if (!blobReader.ReadString(keyType) || !blobReader.ReadString(signature)) {
+		return false;
+	}
+
+	CryptoPP::ed25519::Verifier verifier(publicKey);
+	return verifier.VerifyMessage((const CryptoPP::byte*)data.data(), data.size(), signature.data, signature.size);
+}
+
+int main() {
+	const std::vector<uint8_t> deviceKey = { 'd', 'e', 'v', 'i', 'c', 'e' };
+	IdentityList identities;
+	identities.Add("ssh://alice@a.example.com", deviceKey);
+
+	DevicePool devices;
+	AgentCore agent(devices, identities);
+	AgentClient client;
+	SharedResponse response;
+
+	uint8_t seed[32];
+	for (size_t i = 0; i < sizeof(seed); ++i) {
+		seed[i] = (uint8_t)(i * 13 + 7);
+	}
+	CryptoPP::ed25519::Signer keySigner(seed);
+	const uint8_t* publicKey = static_cast<const CryptoPP::ed25519PrivateKey&>(keySigner.GetPrivateKey()).GetPublicKeyBytePtr();
+
+	std::vector<uint8_t> keyBlob;
+	SshWriter blobWriter(keyBlob);
+	blobWriter.WriteString("ssh-ed25519");
+	blobWriter.WriteString(publicKey, 32);
+
+	// a private key that does not belong to the public key is refused
+	uint8_t otherSeed[32] = { 1 };
+	CHECK(Send(agent, client, MakeAddRequest(otherSeed, publicKey, "mismatched"), response) == SSH_AGENT_FAILURE);
+
+	CHECK(Send(agent, client, MakeAddRequest(seed, publicKey, "added"), response) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, client) == std::vector<std::vector<uint8_t>>({ deviceKey, keyBlob }));
+	CHECK(agent.GetNumLoadedKeys() == 2);
+
+	// every thread signs on, with signers shared through the key
+	std::atomic<size_t> valid(0);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&, t]() {
+			for (size_t i = 0; i < signsPerThread; ++i) {
+				if (SignsWith(agent, keyBlob, publicKey, "data " + std::to_string(t) + " " + std::to_string(i))) {
+					valid++;
+				}
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	CHECK(valid == numThreads * signsPerThread);
+
+	// removed, it is neither listed nor used
+	const std::vector<uint8_t> remove = MakeRequest(SSH2_AGENTC_REMOVE_IDENTITY, [&](SshWriter& writer) {
+		writer.WriteString(keyBlob.data(), keyBlob.size());
+	});
+	CHECK(Send(agent, client, remove, response) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, client) == std::vector<std::vector<uint8_t>>({ deviceKey }));
+	CHECK(!SignsWith(agent, keyBlob, publicKey, "after removal"));
+	CHECK(Send(agent, client, remove, response) == SSH_AGENT_FAILURE);
+
+	// added again it signs again, removing all leaves the device keys
+	CHECK(Send(agent, client, MakeAddRequest(seed, publicKey, "added again"), response) == SSH_AGENT_SUCCESS);
+	CHECK(SignsWith(agent, keyBlob, publicKey, "added again"));
+	CHECK(Send(agent, client, MakeRequest(SSH2_AGENTC_REMOVE_ALL_IDENTITIES), response) == SSH_AGENT_SUCCESS);
+	CHECK(ListKeys(agent, client) == std::vector<std::vector<uint8_t>>({ deviceKey }));
+	CHECK(agent.GetNumLoadedKeys() == 1);
+
+	return TestResult();
+}
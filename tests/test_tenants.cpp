@@ -0,0 +1,176 @@
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "agent_core.h"
+#include "agent_socket_server.h"
+#include "agent_test_util.h"
+#include "test_util.h"
+
+// A tenant is offered and may use only its allowed identities, cannot change
+// the keys the others get, and its socket takes only its own user and up to
+// its connection limit.
+
+static std::vector<uint8_t> MakeBlob(const std::string& text) {
+	return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+// true when the request went on to a device, false when it was answered at once
+static bool NeedsDevice(AgentCore& agent, AgentClient& client, const std::vector<uint8_t>& request) {
+	SharedResponse response;
+	return !agent.HandleFastRequest(client, request.data(), request.size(), response);
+}
+
+static std::vector<uint8_t> MakeSignRequest(const std::vector<uint8_t>& keyBlob) {
+	return MakeRequest(SSH2_AGENTC_SIGN_REQUEST, [&](SshWriter& writer) {
+		writer.WriteString(keyBlob.data(), keyBlob.size());
+		writer.WriteString("data");
+		writer.WriteUint32(0);
+	});
+}
+
+static void TestIdentities() {
+	const std::vector<uint8_t> keyA = MakeBlob("key of alice and dave");
+	const std::vector<uint8_t> keyB = MakeBlob("key of bob");
+	const std::vector<uint8_t> keyC = MakeBlob("key of carol");
+
+	IdentityList identities;
+	identities.Add("ssh://alice@a.example.com", keyA);
+	identities.Add("ssh://bob@b.example.com", keyB);
+	identities.Add("ssh://carol@c.example.com", keyC);
+	identities.Add("ssh://dave@d.example.com", keyA);
+
+	// no protocol is ssh, as in the address the key is derived from
+	std::shared_ptr<AgentTenant> tenant = std::make_shared<AgentTenant>();
+	tenant->name = "ci";
+	tenant->allowedIdentities.push_back(Identity("bob@b.example.com"));
+	tenant->allowedIdentities.push_back(Identity("ssh://dave@d.example.com"));
+
+	DevicePool devices;
+	AgentCore agent(devices, identities);
+	AgentClient client;
+	client.tenant = tenant;
+	CHECK(ListKeys(agent, client) == std::vector<std::vector<uint8_t>>({ keyB, keyA }));
+
+	AgentClient unrestricted;
+	CHECK(ListKeys(agent, unrestricted).size() == 4);
+
+	// a key shared with an allowed identity is usable through it
+	CHECK(NeedsDevice(agent, client, MakeSignRequest(keyA)));
+	CHECK(NeedsDevice(agent, client, MakeSignRequest(keyB)));
+	CHECK(!NeedsDevice(agent, client, MakeSignRequest(keyC)));
+	CHECK(NeedsDevice(agent, unrestricted, MakeSignRequest(keyC)));
+
+	// the keys added by clients are seen by every tenant
+	SharedResponse response;
+	const std::vector<uint8_t> removeAll = MakeRequest(SSH2_AGENTC_REMOVE_ALL_IDENTITIES);
+	CHECK(agent.HandleFastRequest(client, removeAll.data(), removeAll.size(), response));
+	CHECK(ResponseType(response) == SSH_AGENT_FAILURE);
+	CHECK(agent.HandleFastRequest(unrestricted, removeAll.data(), removeAll.size(), response));
+	CHECK(ResponseType(response) == SSH_AGENT_SUCCESS);
+
+	// a tenant without allowed identities gets them all
+	AgentClient open;
+	std::shared_ptr<AgentTenant> openTenant = std::make_shared<AgentTenant>();
+	openTenant->name = "open";
+	open.tenant = openTenant;
+	CHECK(ListKeys(agent, open).size() == 4);
+}
+
+// new connection to the socket at path, outFd is -1 when connecting failed
+static bool Connect(const std::string& path, int& outFd) {
+	outFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	timeval timeout = { 5, 0 };
+	setsockopt(outFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	// '@' stands for the leading zero of an abstract name
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, path.data(), path.size());
+	if (path[0] == '@') {
+		address.sun_path[0] = '\0';
+	}
+	if (connect(outFd, (sockaddr*)&address, (socklen_t)(offsetof(sockaddr_un, sun_path) + path.size())) != 0) {
+		close(outFd);
+		outFd = -1;
+		return false;
+	}
+
+	return true;
+}
+
+// whether the connection is answered, a refused one is closed without an answer
+static bool IsServed(int fd) {
+	const std::vector<uint8_t> request = MakeRequest(SSH2_AGENTC_REQUEST_IDENTITIES);
+	if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size()) {
+		return false;
+	}
+
+	uint8_t header[5];
+	return recv(fd, header, sizeof(header), MSG_WAITALL) == sizeof(header) && header[4] == SSH2_AGENT_IDENTITIES_ANSWER;
+}
+
+static void TestSockets() {
+	IdentityList identities;
+	identities.Add("ssh://alice@a.example.com", MakeBlob("key of alice"));
+	DevicePool devices;
+	AgentCore agent(devices, identities);
+
+	const std::string prefix = "@test_tenants." + std::to_string(getpid()) + ".";
+	std::shared_ptr<AgentTenant> own = std::make_shared<AgentTenant>();
+	own->name = "own";
+	own->uid = (long)geteuid();
+	own->maxConnections = 1;
+	std::shared_ptr<AgentTenant> other = std::make_shared<AgentTenant>();
+	other->name = "other";
+	other->uid = (long)geteuid() + 1;
+
+	AgentSocketServer server(agent, std::string());
+	server.AddListener(prefix + "own", own);
+	server.AddListener(prefix + "other", other);
+	server.AddListener(prefix + "default", nullptr);
+	CHECK(server.Listen());
+	std::thread serverThread([&server]() {
+		server.Run();
+	});
+
+	// the tenant's user, up to its connection limit
+	int first = -1;
+	int second = -1;
+	CHECK(Connect(prefix + "own", first) && IsServed(first));
+	CHECK(Connect(prefix + "own", second) && !IsServed(second));
+	close(second);
+
+	// another user's tenant
+	int fd = -1;
+	CHECK(Connect(prefix + "other", fd) && !IsServed(fd));
+	close(fd);
+
+	// an abstract socket without a tenant takes the agent's own user
+	CHECK(Connect(prefix + "default", fd) && IsServed(fd));
+	close(fd);
+
+	// a slot frees up once the first client left
+	close(first);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	CHECK(Connect(prefix + "own", fd) && IsServed(fd));
+	close(fd);
+
+	server.Stop();
+	serverThread.join();
+}
+
+int main() {
+	TestIdentities();
+	TestSockets();
+	return TestResult();
+}
@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "agent_core.h"
+#include "emulated_device.h"
+#include "hid_trace.h"
+#include "test_util.h"
+
+// A session with the emulator recorded through DevicePool's trace path plays
+// back from the trace alone: same answers and no mismatch. A session asking
+// for something else is caught as mismatches.
+
+constexpr char tracePath[] = "test_trace_replay.trace";
+
+class IdentityList : public IdentityStore {
+public:
+	size_t GetNumIdentities() const override {
+		return mIdentities.size();
+	}
+
+	const Identity& GetIdentityByIndex(size_t index) const override {
+		return mIdentities[index];
+	}
+
+	uint64_t GetGeneration() const override {
+		return mIdentities.size();
+	}
+
+	std::vector<Identity> mIdentities;
+};
+
+struct SessionResult {
+	std::vector<uint8_t> keyBlob;
+	std::vector<uint8_t> signResponse;
+};
+
+// fetches the key of address and signs with it, as the agent does for ssh
+static SessionResult RunSession(DevicePool& devices, const std::string& address) {
+	SessionResult result;
+	IdentityList identities;
+	AgentCore agent(devices, identities);
+	if (!devices.Open()) {
+		return result;
+	}
+
+	Identity ident(address);
+	ident.InitKeyType("nistp256");
+	uint16_t status = 0;
+	ident.pubkey_cached = agent.FetchPublicKey(ident, &status);
+	if (ident.pubkey_cached.Empty()) {
+		return result;
+	}
+	identities.mIdentities.push_back(ident);
+	result.keyBlob = ident.pubkey_cached.Get();
+
+	std::vector<uint8_t> request;
+	SshWriter writer(request);
+	const size_t messageStart = writer.BeginLength();
+	writer.WriteByte((uint8_t)SSH2_AGENTC_SIGN_REQUEST);
+	writer.WriteString(result.keyBlob.data(), result.keyBlob.size());
+	writer.WriteString(std::string("challenge to sign"));
+	writer.WriteUint32(0);
+	writer.EndLength(messageStart);
+
+	AgentClient client;
+	SharedResponse response;
+	agent.HandleRequest(client, request.data(), request.size(), response);
+	if (response != nullptr) {
+		result.signResponse = *response;
+	}
+	return result;
+}
+
+int main() {
+	SessionResult recorded;
+	{
+		DevicePool devices;
+		devices.SetTracePath(tracePath);
+		devices.Attach(std::unique_ptr<HidBackend>(new EmulatedDevice()));
+		recorded = RunSession(devices, "ssh://user@host");
+	}
+	CHECK(!recorded.keyBlob.empty());
+	CHECK(recorded.signResponse.size() > 5 && recorded.signResponse[4] == SSH2_AGENT_SIGN_RESPONSE);
+
+	{
+		ReplayBackend* replay = new ReplayBackend(tracePath, false);
+		CHECK(replay->IsLoaded());
+		DevicePool devices;
+		devices.Attach(std::unique_ptr<HidBackend>(replay));
+		SessionResult replayed = RunSession(devices, "ssh://user@host");
+		CHECK(replayed.keyBlob == recorded.keyBlob);
+		CHECK(replayed.signResponse == recorded.signResponse);
+		CHECK(replay->GetMismatches() == 0);
+	}
+
+	{
+		// another key path is written where the recording has the first one
+		ReplayBackend* replay = new ReplayBackend(tracePath, false);
+		DevicePool devices;
+		devices.Attach(std::unique_ptr<HidBackend>(replay));
+		RunSession(devices, "ssh://other@host");
+		CHECK(replay->GetMismatches() > 0);
+	}
+
+	remove(tracePath);
+	return TestResult();
+}
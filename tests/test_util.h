@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal checks for the test programs: a failed check is reported and the
+// program exits non-zero through TestResult, the remaining checks still run.
+
+static int gTestFailures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			gTestFailures++; \
+		} \
+	} while (0)
+
+// exit code of the test program
+static inline int TestResult() {
+	if (gTestFailures != 0) {
+		fprintf(stderr, "%d checks failed\n", gTestFailures);
+		return 1;
+	}
+
+	return 0;
+}